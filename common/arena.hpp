@@ -0,0 +1,349 @@
+#pragma once
+
+// Process-wide arena for the large per-size buffers of the tasks.
+//
+// Memory is mapped in chunks that start on a 2 MB boundary and are backed
+// by huge pages, so a matrix walked column-wise needs one TLB entry per
+// 2 MB instead of per 4 KB. ARENA_PAGES picks the backing:
+//   thp       (default) madvise(MADV_HUGEPAGE) on ordinary anonymous memory
+//   explicit  MAP_HUGETLB from the reserved pool (vm.nr_hugepages); falls
+//             back to thp when the pool is empty
+//   4k        MADV_NOHUGEPAGE, the baseline to compare against
+//
+// Freed blocks go back to a free list (coalesced with their neighbours) and
+// are handed out again, so the next size, the next kernel or the next
+// receive reuses pages that are already mapped and faulted in rather than
+// paying for fresh zeroed pages. Nothing is returned to the kernel before
+// the arena is destroyed.
+//
+// Blocks are aligned to a cache line; blocks of 2 MB or more are rounded to
+// and aligned on a huge page. Allocator<T> default-initialises like
+// numa::FirstTouchAllocator, but only fresh pages are placed by the thread
+// that first writes them (at 2 MB granularity with huge pages): a reused
+// block keeps the placement of its earlier owner, and every allocation
+// takes one lock. The OpenMP programs therefore keep first-touch vectors;
+// the arena serves the MPI and OpenCL hosts, whose buffers are filled by a
+// single thread anyway.
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace arena {
+
+constexpr std::size_t kHugePage = std::size_t(2) << 20;
+constexpr std::size_t kAlignment = 64;
+constexpr std::size_t kMinChunk = 16 * kHugePage;
+
+enum class Pages { Transparent, Explicit, Small };
+
+inline const char* to_string(Pages p) {
+    switch (p) {
+        case Pages::Transparent: return "thp";
+        case Pages::Explicit: return "explicit";
+        case Pages::Small: return "4k";
+    }
+    return "?";
+}
+
+inline Pages pages_from_env() {
+    const char* env = std::getenv("ARENA_PAGES");
+    std::string v = env ? env : "thp";
+    if (v == "explicit") return Pages::Explicit;
+    if (v == "4k") return Pages::Small;
+    return Pages::Transparent;
+}
+
+inline long minor_faults() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+// Counters since the last reset_stats(); mappedBytes and chunks are totals.
+struct Stats {
+    long allocations = 0;
+    double allocatedBytes = 0.0;
+    double newlyMappedBytes = 0.0;
+    long faultsAtReset = 0;
+    long chunks = 0;
+    double mappedBytes = 0.0;
+};
+
+class Arena {
+public:
+    explicit Arena(Pages pages = pages_from_env()) : pages_(pages) {
+        stats_.faultsAtReset = minor_faults();
+    }
+    ~Arena() {
+        for (const auto& c : chunks_) munmap(c.base, c.bytes);
+    }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(std::size_t bytes) {
+        const std::size_t align = bytes >= kHugePage ? kHugePage : kAlignment;
+        const std::size_t size = round_up(std::max<std::size_t>(bytes, 1), align);
+        std::lock_guard<std::mutex> lock(mutex_);
+        char* p = take(size, align);
+        if (!p && map_chunk(size + align)) p = take(size, align);
+        if (!p) throw std::bad_alloc();
+        live_[p] = size;
+        ++stats_.allocations;
+        stats_.allocatedBytes += static_cast<double>(size);
+        return p;
+    }
+
+    void deallocate(void* ptr) {
+        if (!ptr) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = live_.find(static_cast<char*>(ptr));
+        if (it == live_.end()) return;
+        char* p = it->first;
+        std::size_t size = it->second;
+        live_.erase(it);
+        // Merge with the free neighbours on either side.
+        auto next = free_.lower_bound(p);
+        if (next != free_.end() && next->first == p + size) {
+            size += next->second;
+            next = erase_free(next);
+        }
+        if (next != free_.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == p) {
+                p = prev->first;
+                size += prev->second;
+                erase_free(prev);
+            }
+        }
+        add_free(p, size);
+    }
+
+    // Maps enough up front that `bytes` can be allocated later without a new
+    // chunk; call it with the largest size before a size sweep so every size
+    // is carved from the same pages.
+    void reserve(std::size_t bytes) {
+        const std::size_t align = bytes >= kHugePage ? kHugePage : kAlignment;
+        const std::size_t size = round_up(std::max<std::size_t>(bytes, 1), align);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!fits(size, align)) map_chunk(size + align);
+    }
+
+    Pages pages() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pages_;
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    void reset_stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.allocations = 0;
+        stats_.allocatedBytes = 0.0;
+        stats_.newlyMappedBytes = 0.0;
+        stats_.faultsAtReset = minor_faults();
+    }
+
+    // Bytes of the arena the kernel currently backs with huge pages, from
+    // /proc/self/smaps (AnonHugePages for THP, *_Hugetlb for MAP_HUGETLB).
+    double huge_bytes() const {
+        std::vector<Chunk> chunks;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            chunks = chunks_;
+        }
+        std::ifstream smaps("/proc/self/smaps");
+        std::string line;
+        bool inside = false;
+        double kb = 0.0;
+        while (std::getline(smaps, line)) {
+            unsigned long start = 0, end = 0;
+            char dash = 0;
+            std::istringstream head(line);
+            if ((head >> std::hex >> start >> dash >> end) && dash == '-') {
+                inside = false;
+                for (const auto& c : chunks) {
+                    auto base = reinterpret_cast<unsigned long>(c.base);
+                    if (start >= base && end <= base + c.bytes) inside = true;
+                }
+                continue;
+            }
+            if (!inside) continue;
+            if (line.rfind("AnonHugePages:", 0) == 0 || line.rfind("Private_Hugetlb:", 0) == 0 ||
+                line.rfind("Shared_Hugetlb:", 0) == 0) {
+                kb += std::atof(line.c_str() + line.find(':') + 1);
+            }
+        }
+        return kb * 1024.0;
+    }
+
+private:
+    struct Chunk {
+        char* base;
+        std::size_t bytes;
+    };
+
+    static std::size_t round_up(std::size_t n, std::size_t a) { return (n + a - 1) / a * a; }
+
+    static char* align_up(char* p, std::size_t a) {
+        return reinterpret_cast<char*>(round_up(reinterpret_cast<std::uintptr_t>(p), a));
+    }
+
+    // Best fit: the smallest free block that still holds `size` once its
+    // start is aligned. Leftovers on either side stay free.
+    char* take(std::size_t size, std::size_t align) {
+        for (auto it = bySize_.lower_bound(size); it != bySize_.end(); ++it) {
+            char* block = it->second;
+            const std::size_t blockBytes = it->first;
+            char* start = align_up(block, align);
+            if (start + size > block + blockBytes) continue;
+            erase_free(free_.find(block));
+            if (start > block) add_free(block, start - block);
+            if (start + size < block + blockBytes) add_free(start + size, block + blockBytes - start - size);
+            return start;
+        }
+        return nullptr;
+    }
+
+    bool fits(std::size_t size, std::size_t align) const {
+        for (auto it = bySize_.lower_bound(size); it != bySize_.end(); ++it) {
+            if (align_up(it->second, align) + size <= it->second + it->first) return true;
+        }
+        return false;
+    }
+
+    void add_free(char* p, std::size_t size) {
+        free_[p] = size;
+        bySize_.emplace(size, p);
+    }
+
+    std::map<char*, std::size_t>::iterator erase_free(std::map<char*, std::size_t>::iterator it) {
+        auto range = bySize_.equal_range(it->second);
+        for (auto s = range.first; s != range.second; ++s) {
+            if (s->second == it->first) {
+                bySize_.erase(s);
+                break;
+            }
+        }
+        return free_.erase(it);
+    }
+
+    bool map_chunk(std::size_t bytes) {
+        const std::size_t len = round_up(std::max(bytes, kMinChunk), kHugePage);
+        char* base = nullptr;
+#ifdef MAP_HUGETLB
+        if (pages_ == Pages::Explicit) {
+            void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                base = static_cast<char*>(p);
+            } else {
+                std::fprintf(stderr, "[arena] MAP_HUGETLB failed (%s), using transparent huge pages\n",
+                             std::strerror(errno));
+                pages_ = Pages::Transparent;
+            }
+        }
+#endif
+        if (!base) {
+            // Over-map by one huge page and trim, so the chunk starts on a
+            // 2 MB boundary and THP can back it from its first byte.
+            const std::size_t span = len + kHugePage;
+            void* p = mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) return false;
+            char* raw = static_cast<char*>(p);
+            base = align_up(raw, kHugePage);
+            if (base > raw) munmap(raw, base - raw);
+            if (raw + span > base + len) munmap(base + len, raw + span - base - len);
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+            madvise(base, len, pages_ == Pages::Small ? MADV_NOHUGEPAGE : MADV_HUGEPAGE);
+#endif
+        }
+        chunks_.push_back({base, len});
+        ++stats_.chunks;
+        stats_.mappedBytes += static_cast<double>(len);
+        stats_.newlyMappedBytes += static_cast<double>(len);
+        add_free(base, len);
+        return true;
+    }
+
+    Pages pages_;
+    mutable std::mutex mutex_;
+    std::vector<Chunk> chunks_;
+    std::map<char*, std::size_t> free_;           // by address, for merging
+    std::multimap<std::size_t, char*> bySize_;    // same blocks, for best fit
+    std::map<char*, std::size_t> live_;
+    Stats stats_;
+};
+
+// The arena every Allocator uses unless given another one.
+inline Arena& shared() {
+    static Arena a;
+    return a;
+}
+
+// Allocator for standard containers: `arena::Vector<double> v(n)` takes its
+// storage from the shared arena and leaves it uninitialised.
+template <typename T>
+struct Allocator {
+    using value_type = T;
+
+    Allocator() noexcept : arena(&shared()) {}
+    explicit Allocator(Arena& a) noexcept : arena(&a) {}
+    template <typename U>
+    Allocator(const Allocator<U>& other) noexcept : arena(other.arena) {}
+
+    T* allocate(std::size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T))); }
+    void deallocate(T* p, std::size_t) noexcept { arena->deallocate(p); }
+
+    template <typename U>
+    void construct(U* p) noexcept(std::is_nothrow_default_constructible<U>::value) {
+        ::new (static_cast<void*>(p)) U;
+    }
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+
+    Arena* arena;
+};
+
+template <typename T, typename U>
+bool operator==(const Allocator<T>& a, const Allocator<U>& b) noexcept { return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const Allocator<T>& a, const Allocator<U>& b) noexcept { return a.arena != b.arena; }
+
+template <typename T>
+using Vector = std::vector<T, Allocator<T>>;
+
+inline void reset_stats() { shared().reset_stats(); }
+
+// One line per size: what this size allocated, what it had to map and
+// fault in, and how much of the arena sits on huge pages.
+inline void print_stats(const std::string& label) {
+    const Stats s = shared().stats();
+    if (s.chunks == 0) return;
+    std::printf("[arena] %s: %ld allocations (%.3g MB), %.3g MB newly mapped, %ld minor faults; "
+                "%.3g MB in %ld chunks, %.3g MB on huge pages (%s)\n",
+                label.c_str(), s.allocations, s.allocatedBytes / 1e6, s.newlyMappedBytes / 1e6,
+                minor_faults() - s.faultsAtReset, s.mappedBytes / 1e6, s.chunks,
+                shared().huge_bytes() / 1e6, to_string(shared().pages()));
+}
+
+} // namespace arena
@@ -0,0 +1,197 @@
+#pragma once
+
+// Centralised barriers built on C++ atomics. Every barrier exposes the same
+// interface, so an OpenMP kernel can swap `#pragma omp barrier` for
+//
+//     barrier.arrive_and_wait(omp_get_thread_num());
+//
+// inside a parallel region of exactly `thread_count` threads.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace barriers {
+
+constexpr std::size_t kCacheLine = 64;
+constexpr int kSpinsBeforeYield = 1 << 10;
+
+// Busy-wait step: pause for a while, then start yielding so oversubscribed
+// runs (more threads than cores) still make progress.
+inline void spin_wait(int& spins) {
+    if (++spins < kSpinsBeforeYield) {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#endif
+    } else {
+        std::this_thread::yield();
+    }
+}
+
+template <typename Pred>
+inline void spin_until(Pred&& done) {
+    int spins = 0;
+    while (!done()) {
+        spin_wait(spins);
+    }
+}
+
+// Centralised sense-reversing barrier: one shared counter, the last thread
+// to arrive resets it and flips the global sense.
+class SenseBarrier {
+public:
+    explicit SenseBarrier(int thread_count)
+        : thread_count_(thread_count), count_(thread_count), local_(thread_count) {}
+
+    static const char* name() { return "sense-reversing"; }
+
+    void arrive_and_wait(int tid) {
+        bool my_sense = !local_[tid].sense;
+        local_[tid].sense = my_sense;
+        if (count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            count_.store(thread_count_, std::memory_order_relaxed);
+            sense_.store(my_sense, std::memory_order_release);
+        } else {
+            spin_until([&] { return sense_.load(std::memory_order_acquire) == my_sense; });
+        }
+    }
+
+private:
+    struct alignas(kCacheLine) Local {
+        bool sense = false;
+    };
+
+    const int thread_count_;
+    alignas(kCacheLine) std::atomic<int> count_;
+    alignas(kCacheLine) std::atomic<bool> sense_{false};
+    std::vector<Local> local_;
+};
+
+// Dissemination barrier (Hensgen, Finkel, Manber): ceil(log2 P) rounds, in
+// round r thread i signals thread (i + 2^r) mod P. No shared hot spot.
+class DisseminationBarrier {
+public:
+    explicit DisseminationBarrier(int thread_count)
+        : thread_count_(thread_count), nodes_(new Node[thread_count]) {
+        while ((1 << rounds_) < thread_count_) {
+            ++rounds_;
+        }
+    }
+
+    static const char* name() { return "dissemination"; }
+
+    void arrive_and_wait(int tid) {
+        Node& me = nodes_[tid];
+        for (int r = 0; r < rounds_; ++r) {
+            Node& partner = nodes_[(tid + (1 << r)) % thread_count_];
+            partner.flags[me.parity][r].store(me.sense, std::memory_order_release);
+            auto& flag = me.flags[me.parity][r];
+            spin_until([&] { return flag.load(std::memory_order_acquire) == me.sense; });
+        }
+        if (me.parity == 1) {
+            me.sense = !me.sense;
+        }
+        me.parity = 1 - me.parity;
+    }
+
+private:
+    static constexpr int kMaxRounds = 32;
+
+    struct alignas(kCacheLine) Node {
+        std::atomic<bool> flags[2][kMaxRounds] = {};
+        int parity = 0;
+        bool sense = true;
+    };
+
+    const int thread_count_;
+    int rounds_ = 0;
+    std::unique_ptr<Node[]> nodes_;
+};
+
+// Software combining tree: threads arrive at a leaf shared by `kFanIn`
+// siblings, the last one to arrive climbs to the parent, and whoever
+// completes the root flips the global sense.
+class TreeBarrier {
+public:
+    static constexpr int kFanIn = 4;
+
+    explicit TreeBarrier(int thread_count)
+        : local_(thread_count), leaf_of_(thread_count) {
+        // Build the tree bottom-up; level 0 groups threads, higher levels
+        // group the nodes of the level below.
+        int level_begin = 0;
+        int level_size = (thread_count + kFanIn - 1) / kFanIn;
+        for (int t = 0; t < thread_count; ++t) {
+            leaf_of_[t] = t / kFanIn;
+        }
+        for (int n = 0; n < level_size; ++n) {
+            int children = std::min(kFanIn, thread_count - n * kFanIn);
+            nodes_.emplace_back(children);
+        }
+        while (level_size > 1) {
+            int next_begin = static_cast<int>(nodes_.size());
+            int next_size = (level_size + kFanIn - 1) / kFanIn;
+            for (int n = 0; n < next_size; ++n) {
+                int children = std::min(kFanIn, level_size - n * kFanIn);
+                nodes_.emplace_back(children);
+            }
+            for (int n = 0; n < level_size; ++n) {
+                nodes_[level_begin + n].parent = next_begin + n / kFanIn;
+            }
+            level_begin = next_begin;
+            level_size = next_size;
+        }
+    }
+
+    static const char* name() { return "combining-tree"; }
+
+    void arrive_and_wait(int tid) {
+        bool my_sense = !local_[tid].sense;
+        local_[tid].sense = my_sense;
+        int node = leaf_of_[tid];
+        while (true) {
+            Node& n = nodes_[node];
+            if (n.count.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                break;
+            }
+            // Last arrival at this node: re-arm it before moving up. Nobody
+            // can re-enter it until the root releases the current episode.
+            n.count.store(n.fan_in, std::memory_order_relaxed);
+            if (n.parent < 0) {
+                sense_.store(my_sense, std::memory_order_release);
+                return;
+            }
+            node = n.parent;
+        }
+        spin_until([&] { return sense_.load(std::memory_order_acquire) == my_sense; });
+    }
+
+private:
+    struct alignas(kCacheLine) Node {
+        explicit Node(int children) : count(children), fan_in(children) {}
+        Node(Node&& other) noexcept
+            : count(other.count.load()), fan_in(other.fan_in), parent(other.parent) {}
+
+        std::atomic<int> count;
+        int fan_in;
+        int parent = -1;
+    };
+
+    struct alignas(kCacheLine) Local {
+        bool sense = false;
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<Local> local_;
+    std::vector<int> leaf_of_;
+    alignas(kCacheLine) std::atomic<bool> sense_{false};
+};
+
+} // namespace barriers
@@ -0,0 +1,190 @@
+#pragma once
+
+// LogGP communication model measured by task-1/mpi and used by the other MPI
+// programs to choose how (and on how many ranks) to distribute a problem.
+//
+//   L  - wire latency (s)
+//   o  - per-message CPU overhead on each side (s)
+//   g  - gap between consecutive small messages from one rank (s)
+//   G  - gap per byte for long messages, i.e. 1 / bandwidth (s/B)
+
+#include <mpi.h>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+namespace comm {
+
+constexpr const char* kDefaultModelPath = "../comm_model.txt";
+
+struct LogGP {
+    double L = 0.0;
+    double o = 0.0;
+    double g = 0.0;
+    double G = 0.0;
+    int measuredRanks = 0;
+};
+
+// The model file lives next to the tasks unless COMM_MODEL points elsewhere.
+inline std::string model_path() {
+    const char* env = std::getenv("COMM_MODEL");
+    return env ? env : kDefaultModelPath;
+}
+
+inline bool save_model(const LogGP& m, const std::string& path) {
+    std::ofstream out(path);
+    if (!out) return false;
+    out.precision(9);
+    out << "L=" << m.L << "\n"
+        << "o=" << m.o << "\n"
+        << "g=" << m.g << "\n"
+        << "G=" << m.G << "\n"
+        << "ranks=" << m.measuredRanks << "\n";
+    return static_cast<bool>(out);
+}
+
+inline bool load_model(LogGP& m, const std::string& path) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string line;
+    int fields = 0;
+    while (std::getline(in, line)) {
+        auto eq = line.find('=');
+        if (eq == std::string::npos) continue;
+        std::string key = line.substr(0, eq);
+        double value = std::atof(line.c_str() + eq + 1);
+        if (key == "L")          { m.L = value; ++fields; }
+        else if (key == "o")     { m.o = value; ++fields; }
+        else if (key == "g")     { m.g = value; ++fields; }
+        else if (key == "G")     { m.G = value; ++fields; }
+        else if (key == "ranks") { m.measuredRanks = static_cast<int>(value); }
+    }
+    return fields == 4;
+}
+
+inline int tree_depth(int ranks) {
+    int depth = 0;
+    while ((1 << depth) < ranks) ++depth;
+    return depth;
+}
+
+// --- LogGP predictions ------------------------------------------------------
+
+// One message of `bytes` between two ranks.
+inline double p2p_time(const LogGP& m, double bytes) {
+    return m.L + 2 * m.o + bytes * m.G;
+}
+
+// Root sends `messages` messages to each of ranks-1 peers one after another;
+// `bytes` is the payload per peer.
+inline double fanout_time(const LogGP& m, int ranks, int messages, double bytes) {
+    if (ranks <= 1) return 0.0;
+    double perMessage = std::max(m.g, m.o);
+    return (ranks - 1) * (messages * perMessage + bytes * m.G) + m.L + m.o;
+}
+
+// Binomial-tree broadcast of `bytes` to all ranks.
+inline double bcast_time(const LogGP& m, int ranks, double bytes) {
+    return tree_depth(ranks) * p2p_time(m, bytes);
+}
+
+// Binomial-tree scatter (or gather) of `totalBytes` split evenly over ranks.
+inline double scatter_time(const LogGP& m, int ranks, double totalBytes) {
+    if (ranks <= 1) return 0.0;
+    return tree_depth(ranks) * (m.L + 2 * m.o) + totalBytes * (ranks - 1) / ranks * m.G;
+}
+
+// --- Strategy selection -----------------------------------------------------
+
+enum class Strategy { Local = 0, PointToPoint = 1, Collective = 2 };
+
+inline const char* to_string(Strategy s) {
+    switch (s) {
+        case Strategy::Local:        return "local";
+        case Strategy::PointToPoint: return "p2p";
+        case Strategy::Collective:   return "collective";
+    }
+    return "?";
+}
+
+// What one run of a kernel has to move and compute.
+struct Workload {
+    double scatterBytes = 0.0;   // partitioned input, split over ranks
+    double bcastBytes = 0.0;     // input every rank needs in full
+    double gatherBytes = 0.0;    // partitioned output, collected on root
+    double reduceBytes = 0.0;    // small result reduced onto root
+    int headerMessages = 0;      // extra control messages per peer in p2p mode
+    double computeSeconds = 0.0; // serial compute time on one rank
+};
+
+struct Plan {
+    Strategy strategy = Strategy::PointToPoint;
+    int ranks = 1;
+    double predicted = 0.0;
+};
+
+inline double predict(const LogGP& m, const Workload& w, Strategy s, int ranks) {
+    double compute = w.computeSeconds / ranks;
+    switch (s) {
+        case Strategy::Local:
+            return w.computeSeconds;
+        case Strategy::PointToPoint: {
+            int sendMessages = w.headerMessages + (w.scatterBytes > 0) + (w.bcastBytes > 0);
+            int recvMessages = w.headerMessages + (w.gatherBytes > 0) + (w.reduceBytes > 0);
+            double perPeerOut = w.scatterBytes / ranks + w.bcastBytes;
+            double perPeerBack = w.gatherBytes / ranks + w.reduceBytes;
+            return fanout_time(m, ranks, sendMessages, perPeerOut) + compute
+                 + fanout_time(m, ranks, recvMessages, perPeerBack);
+        }
+        case Strategy::Collective:
+            return scatter_time(m, ranks, w.scatterBytes) + bcast_time(m, ranks, w.bcastBytes)
+                 + compute
+                 + scatter_time(m, ranks, w.gatherBytes)
+                 + (w.reduceBytes > 0 ? bcast_time(m, ranks, w.reduceBytes) : 0.0);
+    }
+    return 0.0;
+}
+
+// Cheapest strategy and rank count (1..maxRanks) for the given workload.
+inline Plan choose_plan(const LogGP& m, const Workload& w, int maxRanks) {
+    Plan best{Strategy::Local, 1, predict(m, w, Strategy::Local, 1)};
+    for (int ranks = 2; ranks <= maxRanks; ++ranks) {
+        for (Strategy s : {Strategy::PointToPoint, Strategy::Collective}) {
+            double t = predict(m, w, s, ranks);
+            if (t < best.predicted) {
+                best = Plan{s, ranks, t};
+            }
+        }
+    }
+    return best;
+}
+
+// Root decides, everybody learns the plan and gets a communicator holding
+// only the participating ranks (MPI_COMM_NULL on the others). Callers end
+// every size with MPI_Barrier(world) on all ranks, idle ones included, so
+// no rank starts the next size's world collectives early.
+inline Plan share_plan(Plan plan, MPI_Comm world, MPI_Comm* active) {
+    int rank = 0;
+    MPI_Comm_rank(world, &rank);
+    int packed[2] = {static_cast<int>(plan.strategy), plan.ranks};
+    MPI_Bcast(packed, 2, MPI_INT, 0, world);
+    plan.strategy = static_cast<Strategy>(packed[0]);
+    plan.ranks = packed[1];
+    MPI_Comm_split(world, rank < plan.ranks ? 0 : MPI_UNDEFINED, rank, active);
+    return plan;
+}
+
+// Falls back to the historical behaviour (point-to-point over every rank)
+// when no model has been measured on this machine yet.
+inline Plan plan_for(const Workload& w, int worldSize, bool& haveModel) {
+    static LogGP model;
+    static bool loaded = load_model(model, model_path());
+    haveModel = loaded;
+    if (!loaded) {
+        return Plan{Strategy::PointToPoint, worldSize, 0.0};
+    }
+    return choose_plan(model, w, worldSize);
+}
+
+} // namespace comm
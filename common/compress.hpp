@@ -0,0 +1,594 @@
+#pragma once
+
+// Optional compressed transport for the scatter/broadcast/gather paths of
+// the MPI programs. The matrices and arrays they ship hold small integers
+// (0..9), so most of their bytes are redundant.
+//
+// Each payload is cut into chunks of kChunkBytes. A chunk is byte-shuffled,
+// so byte k of every element lands in plane k. Each plane is then stored as
+// one of:
+//   - a constant,
+//   - indices into a dictionary of at most 16 values, bit-packed,
+//   - an LZ4-style block,
+//   - raw bytes,
+// whichever is smallest. Chunks are compressed and posted with MPI_Isend
+// one after another, so compression of chunk i+1 overlaps the transfer of
+// chunk i. Receivers pre-post every chunk and decode each one as it lands.
+//
+// A chunk that does not shrink below kMinRatio of its size goes out raw.
+// If the communication model says the wire time saved does not pay for
+// encoding and decoding, the rest of the stream is sent raw.
+//
+// Disabled unless MPI_COMPRESS=1. The wrappers then call the plain MPI
+// collective, so the programs behave exactly as before.
+
+#include <mpi.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "comm_model.hpp"
+
+namespace compress {
+
+constexpr size_t kChunkBytes = 256 * 1024;
+constexpr size_t kMinBytes = 4096;      // smaller payloads are sent as plain MPI
+constexpr double kMinRatio = 0.9;       // a chunk must shrink at least this much
+constexpr int kMaxDictionary = 16;
+constexpr int kTagBcast = 0x6301;
+constexpr int kTagScatter = 0x6302;
+constexpr int kTagGather = 0x6303;
+
+inline bool enabled() {
+    static const bool on = [] {
+        const char* env = std::getenv("MPI_COMPRESS");
+        return env && std::atoi(env) != 0;
+    }();
+    return on;
+}
+
+// Bytes handed to / received from the transport on this rank.
+struct Stats {
+    double rawBytes = 0.0;
+    double wireBytes = 0.0;
+    double codecSeconds = 0.0;
+    long chunks = 0;
+    long bypassed = 0;
+};
+
+inline Stats& stats() {
+    static Stats s;
+    return s;
+}
+
+inline void reset_stats() { stats() = Stats(); }
+
+inline void print_stats(const std::string& label) {
+    const Stats& s = stats();
+    if (s.chunks == 0) return;
+    std::printf("[compress] %s: %.3g MB on the wire for %.3g MB (%.2fx), %ld/%ld chunks raw, "
+                "codec %.3g s\n",
+                label.c_str(), s.wireBytes / 1e6, s.rawBytes / 1e6,
+                s.wireBytes > 0 ? s.rawBytes / s.wireBytes : 0.0, s.bypassed, s.chunks,
+                s.codecSeconds);
+}
+
+// --- LZ block codec ---------------------------------------------------------
+//
+// LZ4 block layout: token (literal length << 4 | match length - 4), extra
+// length bytes for values >= 15, literals, 2-byte little-endian offset.
+// The last sequence carries literals only.
+
+namespace detail {
+
+constexpr int kMinMatch = 4;
+constexpr int kHashBits = 14;
+constexpr int kMaxOffset = 65535;
+
+inline std::uint32_t read32(const std::uint8_t* p) {
+    std::uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+inline void put_length(std::vector<std::uint8_t>& out, size_t len) {
+    while (len >= 255) {
+        out.push_back(255);
+        len -= 255;
+    }
+    out.push_back(static_cast<std::uint8_t>(len));
+}
+
+inline void put_sequence(std::vector<std::uint8_t>& out, const std::uint8_t* lit, size_t litLen,
+                         size_t matchLen, size_t offset, bool last) {
+    size_t ml = last ? 0 : matchLen - kMinMatch;
+    out.push_back(static_cast<std::uint8_t>((std::min<size_t>(litLen, 15) << 4) | std::min<size_t>(ml, 15)));
+    if (litLen >= 15) put_length(out, litLen - 15);
+    out.insert(out.end(), lit, lit + litLen);
+    if (last) return;
+    out.push_back(static_cast<std::uint8_t>(offset & 0xFF));
+    out.push_back(static_cast<std::uint8_t>(offset >> 8));
+    if (ml >= 15) put_length(out, ml - 15);
+}
+
+} // namespace detail
+
+inline void lz_encode(const std::uint8_t* src, size_t n, std::vector<std::uint8_t>& out) {
+    using namespace detail;
+    std::vector<std::int64_t> table(size_t(1) << kHashBits, -1);
+    size_t anchor = 0, i = 0;
+    // The last bytes stay literals so the decoder never reads past a match.
+    const size_t limit = n > 12 ? n - 12 : 0;
+    while (i < limit) {
+        std::uint32_t h = (read32(src + i) * 2654435761u) >> (32 - kHashBits);
+        std::int64_t cand = table[h];
+        table[h] = static_cast<std::int64_t>(i);
+        if (cand < 0 || i - cand > kMaxOffset || read32(src + cand) != read32(src + i)) {
+            ++i;
+            continue;
+        }
+        size_t len = kMinMatch;
+        while (i + len < n - 5 && src[cand + len] == src[i + len]) ++len;
+        put_sequence(out, src + anchor, i - anchor, len, i - cand, false);
+        i += len;
+        anchor = i;
+    }
+    put_sequence(out, src + anchor, n - anchor, 0, 0, true);
+}
+
+// Returns false on malformed input.
+inline bool lz_decode(const std::uint8_t* in, size_t size, std::uint8_t* dst, size_t n) {
+    size_t ip = 0, op = 0;
+    while (ip < size) {
+        std::uint8_t token = in[ip++];
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            std::uint8_t b;
+            do { if (ip >= size) return false; b = in[ip++]; lit += b; } while (b == 255);
+        }
+        if (ip + lit > size || op + lit > n) return false;
+        std::memcpy(dst + op, in + ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip >= size) break;
+        if (ip + 2 > size) return false;
+        size_t offset = in[ip] | (size_t(in[ip + 1]) << 8);
+        ip += 2;
+        size_t len = (token & 15);
+        if (len == 15) {
+            std::uint8_t b;
+            do { if (ip >= size) return false; b = in[ip++]; len += b; } while (b == 255);
+        }
+        len += detail::kMinMatch;
+        if (offset == 0 || offset > op || op + len > n) return false;
+        for (size_t k = 0; k < len; ++k, ++op) dst[op] = dst[op - offset];
+    }
+    return op == n;
+}
+
+// --- Chunk codec ------------------------------------------------------------
+
+enum PlaneKind : std::uint8_t { kConstant = 0, kDictionary = 1, kLz = 2, kRawPlane = 3 };
+enum ChunkMode : std::uint8_t { kRawChunk = 0, kCoded = 1 };
+
+// Chunk header: raw byte count, element size, mode.
+constexpr size_t kHeaderBytes = 8;
+
+inline size_t bound(size_t rawBytes) { return rawBytes + kHeaderBytes; }
+
+inline void put32(std::vector<std::uint8_t>& out, std::uint32_t v) {
+    for (int b = 0; b < 4; ++b) out.push_back(static_cast<std::uint8_t>(v >> (8 * b)));
+}
+
+inline std::uint32_t get32(const std::uint8_t* p) {
+    return p[0] | (std::uint32_t(p[1]) << 8) | (std::uint32_t(p[2]) << 16) | (std::uint32_t(p[3]) << 24);
+}
+
+inline void put_header(std::vector<std::uint8_t>& out, size_t raw, int elemSize, ChunkMode mode) {
+    put32(out, static_cast<std::uint32_t>(raw));
+    out.push_back(static_cast<std::uint8_t>(elemSize));
+    out.push_back(mode);
+    out.push_back(0);
+    out.push_back(0);
+}
+
+inline void encode_plane(const std::uint8_t* plane, size_t n, std::vector<std::uint8_t>& out) {
+    int index[256];
+    std::fill(index, index + 256, -1);
+    std::uint8_t dict[kMaxDictionary];
+    int distinct = 0;
+    for (size_t i = 0; i < n && distinct <= kMaxDictionary; ++i) {
+        if (index[plane[i]] < 0) {
+            if (distinct < kMaxDictionary) dict[distinct] = plane[i];
+            index[plane[i]] = distinct++;
+        }
+    }
+    if (distinct == 1) {
+        out.push_back(kConstant);
+        out.push_back(plane[0]);
+        return;
+    }
+    if (distinct <= kMaxDictionary) {
+        const int bits = distinct <= 2 ? 1 : distinct <= 4 ? 2 : 4;
+        out.push_back(kDictionary);
+        out.push_back(static_cast<std::uint8_t>(bits));
+        out.push_back(static_cast<std::uint8_t>(distinct));
+        out.insert(out.end(), dict, dict + distinct);
+        const int perByte = 8 / bits;
+        for (size_t i = 0; i < n; i += perByte) {
+            std::uint8_t packed = 0;
+            for (int k = 0; k < perByte && i + k < n; ++k) {
+                packed |= static_cast<std::uint8_t>(index[plane[i + k]] << (k * bits));
+            }
+            out.push_back(packed);
+        }
+        return;
+    }
+    std::vector<std::uint8_t> lz;
+    lz_encode(plane, n, lz);
+    if (lz.size() + 4 < n) {
+        out.push_back(kLz);
+        put32(out, static_cast<std::uint32_t>(lz.size()));
+        out.insert(out.end(), lz.begin(), lz.end());
+    } else {
+        out.push_back(kRawPlane);
+        out.insert(out.end(), plane, plane + n);
+    }
+}
+
+// Appends one encoded chunk (header included) to `out`. Falls back to a raw
+// chunk when coding does not reach kMinRatio.
+inline void encode_chunk(const void* data, size_t bytes, int elemSize, std::vector<std::uint8_t>& out) {
+    const std::uint8_t* src = static_cast<const std::uint8_t*>(data);
+    const size_t start = out.size();
+    const size_t n = bytes / elemSize;
+    put_header(out, bytes, elemSize, kCoded);
+    std::vector<std::uint8_t> plane(n);
+    for (int b = 0; b < elemSize; ++b) {
+        for (size_t i = 0; i < n; ++i) plane[i] = src[i * elemSize + b];
+        encode_plane(plane.data(), n, out);
+    }
+    if (out.size() - start > kMinRatio * bytes) {
+        out.resize(start);
+        put_header(out, bytes, elemSize, kRawChunk);
+        out.insert(out.end(), src, src + bytes);
+    }
+}
+
+inline void raw_chunk(const void* data, size_t bytes, int elemSize, std::vector<std::uint8_t>& out) {
+    const std::uint8_t* src = static_cast<const std::uint8_t*>(data);
+    put_header(out, bytes, elemSize, kRawChunk);
+    out.insert(out.end(), src, src + bytes);
+}
+
+// Decodes one chunk of `size` wire bytes into dst; returns false if it is
+// malformed or does not match the expected byte count. Every field is
+// checked against `size` before it is read.
+inline bool decode_chunk(const std::uint8_t* in, size_t size, void* dst, size_t bytes) {
+    if (size < kHeaderBytes || get32(in) != bytes) return false;
+    const int elemSize = in[4];
+    std::uint8_t* out = static_cast<std::uint8_t*>(dst);
+    if (in[5] == kRawChunk) {
+        if (size != kHeaderBytes + bytes) return false;
+        std::memcpy(out, in + kHeaderBytes, bytes);
+        return true;
+    }
+    if (in[5] != kCoded || elemSize == 0 || bytes % elemSize != 0) return false;
+    const size_t n = bytes / elemSize;
+    std::vector<std::uint8_t> plane(n);
+    size_t ip = kHeaderBytes;
+    for (int b = 0; b < elemSize; ++b) {
+        if (ip >= size) return false;
+        const std::uint8_t kind = in[ip++];
+        if (kind == kConstant) {
+            if (ip + 1 > size) return false;
+            std::fill(plane.begin(), plane.end(), in[ip++]);
+        } else if (kind == kDictionary) {
+            if (ip + 2 > size) return false;
+            const int bits = in[ip], distinct = in[ip + 1];
+            if ((bits != 1 && bits != 2 && bits != 4) || distinct == 0 || distinct > (1 << bits)) {
+                return false;
+            }
+            const std::uint8_t* dict = in + ip + 2;
+            ip += 2 + distinct;
+            const int perByte = 8 / bits;
+            const size_t packed = (n + perByte - 1) / perByte;
+            if (ip > size || packed > size - ip) return false;
+            const std::uint8_t mask = static_cast<std::uint8_t>((1 << bits) - 1);
+            for (size_t i = 0; i < n; ++i) {
+                const int index = (in[ip + i / perByte] >> ((i % perByte) * bits)) & mask;
+                if (index >= distinct) return false;
+                plane[i] = dict[index];
+            }
+            ip += packed;
+        } else if (kind == kLz) {
+            if (ip + 4 > size) return false;
+            const size_t len = get32(in + ip);
+            ip += 4;
+            if (len > size - ip || !lz_decode(in + ip, len, plane.data(), n)) return false;
+            ip += len;
+        } else if (kind == kRawPlane) {
+            if (n > size - ip) return false;
+            std::memcpy(plane.data(), in + ip, n);
+            ip += n;
+        } else {
+            return false;
+        }
+        for (size_t i = 0; i < n; ++i) out[i * elemSize + b] = plane[i];
+    }
+    return ip == size;
+}
+
+// --- Streams ----------------------------------------------------------------
+
+inline int type_size(MPI_Datatype type) {
+    int size = 0;
+    MPI_Type_size(type, &size);
+    return size;
+}
+
+// Chunk c of a payload of `bytes`, in bytes; chunk edges fall on elements.
+inline size_t chunk_count(size_t bytes) { return (bytes + kChunkBytes - 1) / kChunkBytes; }
+inline size_t chunk_bytes(size_t bytes, size_t c) { return std::min(kChunkBytes, bytes - c * kChunkBytes); }
+
+inline double wire_seconds_per_byte() {
+    static comm::LogGP model;
+    static bool loaded = comm::load_model(model, comm::model_path());
+    return loaded ? model.G : 0.0;
+}
+
+// Encodes chunks one by one and posts each with MPI_Isend as soon as it is
+// ready; buffers and requests live until wait(). Encoding stops paying off
+// when the wire time it saves (per the comm model) is less than roughly
+// twice the encode time, i.e. encode plus decode; the stream then sends
+// the remaining chunks raw.
+class Sender {
+public:
+    void post(const void* data, size_t bytes, int elemSize, const std::vector<int>& dests,
+              int tag, MPI_Comm comm) {
+        if (dests.empty()) return;
+        const std::uint8_t* src = static_cast<const std::uint8_t*>(data);
+        bool worth = true;
+        for (size_t c = 0; c < chunk_count(bytes); ++c) {
+            const size_t raw = chunk_bytes(bytes, c);
+            buffers_.emplace_back();
+            auto& buf = buffers_.back();
+            double t0 = MPI_Wtime();
+            if (worth) encode_chunk(src + c * kChunkBytes, raw, elemSize, buf);
+            else raw_chunk(src + c * kChunkBytes, raw, elemSize, buf);
+            double spent = MPI_Wtime() - t0;
+            send_wire(buf, dests, tag, comm);
+
+            Stats& s = stats();
+            s.rawBytes += raw * dests.size();
+            s.codecSeconds += worth ? spent : 0.0;
+            s.chunks += 1;
+            if (buf[5] == kRawChunk) s.bypassed += 1;
+            const double G = wire_seconds_per_byte();
+            if (worth && G > 0 && (double(raw) - double(buf.size())) * G * dests.size() < 2 * spent) {
+                worth = false;
+            }
+        }
+    }
+
+    // Sends already-encoded wire bytes (used when forwarding).
+    void send_wire(const std::vector<std::uint8_t>& buf, const std::vector<int>& dests, int tag,
+                   MPI_Comm comm) {
+        for (int d : dests) {
+            requests_.emplace_back();
+            MPI_Isend(buf.data(), static_cast<int>(buf.size()), MPI_BYTE, d, tag, comm, &requests_.back());
+            stats().wireBytes += buf.size();
+        }
+    }
+
+    void keep(std::vector<std::uint8_t>&& buf) { buffers_.push_back(std::move(buf)); }
+    std::vector<std::uint8_t>& last() { return buffers_.back(); }
+
+    void wait() {
+        MPI_Waitall(static_cast<int>(requests_.size()), requests_.data(), MPI_STATUSES_IGNORE);
+        requests_.clear();
+        buffers_.clear();
+    }
+
+private:
+    std::vector<std::vector<std::uint8_t>> buffers_;
+    std::vector<MPI_Request> requests_;
+};
+
+// Pre-posts one receive per chunk of a `bytes` payload from `src`.
+class Receiver {
+public:
+    Receiver(void* data, size_t bytes, int src, int tag, MPI_Comm comm)
+        : data_(static_cast<std::uint8_t*>(data)), bytes_(bytes) {
+        const size_t chunks = chunk_count(bytes);
+        buffers_.resize(chunks);
+        requests_.resize(chunks);
+        for (size_t c = 0; c < chunks; ++c) {
+            buffers_[c].resize(bound(chunk_bytes(bytes, c)));
+            MPI_Irecv(buffers_[c].data(), static_cast<int>(buffers_[c].size()), MPI_BYTE, src, tag,
+                      comm, &requests_[c]);
+        }
+    }
+
+    size_t chunks() const { return requests_.size(); }
+    MPI_Request* requests() { return requests_.data(); }
+
+    // Wire bytes of chunk c once its receive has completed.
+    std::vector<std::uint8_t>& wire(size_t c) { return buffers_[c]; }
+
+    // Call after request c completed with `status`.
+    void decode(size_t c, const MPI_Status& status) {
+        int got = 0;
+        MPI_Get_count(&status, MPI_BYTE, &got);
+        buffers_[c].resize(got);
+        const size_t raw = chunk_bytes(bytes_, c);
+        double t0 = MPI_Wtime();
+        if (!decode_chunk(buffers_[c].data(), got, data_ + c * kChunkBytes, raw)) {
+            std::fprintf(stderr, "compress: corrupt chunk %zu\n", c);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        Stats& s = stats();
+        s.codecSeconds += MPI_Wtime() - t0;
+        s.rawBytes += raw;
+        s.wireBytes += got;
+        s.chunks += 1;
+        if (buffers_[c][5] == kRawChunk) s.bypassed += 1;
+    }
+
+    // Decodes chunks in arrival order.
+    void finish() {
+        for (size_t done = 0; done < chunks(); ++done) {
+            int idx = 0;
+            MPI_Status status;
+            MPI_Waitany(static_cast<int>(chunks()), requests(), &idx, &status);
+            decode(idx, status);
+        }
+    }
+
+private:
+    std::uint8_t* data_;
+    size_t bytes_;
+    std::vector<std::vector<std::uint8_t>> buffers_;
+    std::vector<MPI_Request> requests_;
+};
+
+// --- MPI-shaped wrappers ----------------------------------------------------
+
+inline void send(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm) {
+    const size_t bytes = size_t(count) * type_size(type);
+    if (!enabled() || bytes < kMinBytes) {
+        MPI_Send(buf, count, type, dest, tag, comm);
+        return;
+    }
+    Sender s;
+    s.post(buf, bytes, type_size(type), {dest}, tag, comm);
+    s.wait();
+}
+
+inline void recv(void* buf, int count, MPI_Datatype type, int src, int tag, MPI_Comm comm) {
+    const size_t bytes = size_t(count) * type_size(type);
+    if (!enabled() || bytes < kMinBytes) {
+        MPI_Recv(buf, count, type, src, tag, comm, MPI_STATUS_IGNORE);
+        return;
+    }
+    Receiver r(buf, bytes, src, tag, comm);
+    r.finish();
+}
+
+// Binomial tree rooted at `root`. Inner ranks forward the compressed chunks
+// to their children as they arrive, without re-encoding, and decode them
+// while the next ones are in flight.
+inline void bcast(void* buf, int count, MPI_Datatype type, int root, MPI_Comm comm) {
+    const size_t bytes = size_t(count) * type_size(type);
+    if (!enabled() || bytes < kMinBytes) {
+        MPI_Bcast(buf, count, type, root, comm);
+        return;
+    }
+    int rank = 0, size = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    const int vr = (rank - root + size) % size;
+    int parent = -1, mask = 1;
+    while (mask < size) {
+        if (vr & mask) {
+            parent = (vr - mask + root) % size;
+            break;
+        }
+        mask <<= 1;
+    }
+    std::vector<int> children;
+    for (mask >>= 1; mask > 0; mask >>= 1) {
+        if (vr + mask < size) children.push_back((vr + mask + root) % size);
+    }
+
+    Sender out;
+    if (parent < 0) {
+        out.post(buf, bytes, type_size(type), children, kTagBcast, comm);
+    } else {
+        Receiver in(buf, bytes, parent, kTagBcast, comm);
+        for (size_t c = 0; c < in.chunks(); ++c) {
+            MPI_Status status;
+            MPI_Wait(in.requests() + c, &status);
+            int got = 0;
+            MPI_Get_count(&status, MPI_BYTE, &got);
+            out.keep(std::vector<std::uint8_t>(in.wire(c).begin(), in.wire(c).begin() + got));
+            out.send_wire(out.last(), children, kTagBcast, comm);
+            in.decode(c, status);
+        }
+    }
+    out.wait();
+}
+
+// Root streams each rank's block in turn; encoding the next block overlaps
+// sending the previous ones. recvbuf may be MPI_IN_PLACE on the root.
+inline void scatterv(const void* sendbuf, const int* counts, const int* displs, void* recvbuf,
+                     int recvCount, MPI_Datatype type, int root, MPI_Comm comm) {
+    if (!enabled()) {
+        MPI_Scatterv(sendbuf, counts, displs, type, recvbuf, recvCount, type, root, comm);
+        return;
+    }
+    int rank = 0, size = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    const int elem = type_size(type);
+    if (rank == root) {
+        Sender out;
+        const std::uint8_t* src = static_cast<const std::uint8_t*>(sendbuf);
+        for (int r = 0; r < size; ++r) {
+            const size_t bytes = size_t(counts[r]) * elem;
+            if (r == root) {
+                if (recvbuf != MPI_IN_PLACE) std::memcpy(recvbuf, src + size_t(displs[r]) * elem, bytes);
+            } else if (bytes < kMinBytes) {
+                MPI_Send(src + size_t(displs[r]) * elem, counts[r], type, r, kTagScatter, comm);
+            } else {
+                out.post(src + size_t(displs[r]) * elem, bytes, elem, {r}, kTagScatter, comm);
+            }
+        }
+        out.wait();
+    } else {
+        recv(recvbuf, recvCount, type, root, kTagScatter, comm);
+    }
+}
+
+// Root pre-posts every chunk from every rank up front, then decodes each
+// rank's chunks as they land. sendbuf may be MPI_IN_PLACE on the root.
+inline void gatherv(const void* sendbuf, int sendCount, void* recvbuf, const int* counts,
+                    const int* displs, MPI_Datatype type, int root, MPI_Comm comm) {
+    if (!enabled()) {
+        MPI_Gatherv(sendbuf, sendCount, type, recvbuf, counts, displs, type, root, comm);
+        return;
+    }
+    int rank = 0, size = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    const int elem = type_size(type);
+    if (rank != root) {
+        send(sendbuf, sendCount, type, root, kTagGather, comm);
+        return;
+    }
+    std::uint8_t* dst = static_cast<std::uint8_t*>(recvbuf);
+    if (sendbuf != MPI_IN_PLACE) {
+        std::memcpy(dst + size_t(displs[root]) * elem, sendbuf, size_t(counts[root]) * elem);
+    }
+    std::vector<Receiver> from;
+    std::vector<MPI_Request> plain;
+    from.reserve(size);
+    for (int r = 0; r < size; ++r) {
+        const size_t bytes = size_t(counts[r]) * elem;
+        if (r == root || bytes == 0) continue;
+        if (bytes < kMinBytes) {
+            plain.emplace_back();
+            MPI_Irecv(dst + size_t(displs[r]) * elem, counts[r], type, r, kTagGather, comm, &plain.back());
+        } else {
+            from.emplace_back(dst + size_t(displs[r]) * elem, bytes, r, kTagGather, comm);
+        }
+    }
+    for (auto& f : from) f.finish();
+    MPI_Waitall(static_cast<int>(plain.size()), plain.data(), MPI_STATUSES_IGNORE);
+}
+
+} // namespace compress
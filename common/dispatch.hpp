@@ -0,0 +1,870 @@
+#pragma once
+
+// One entry point for sum, gradient_x, gemm and their batched forms that
+// routes every call to the fastest backend for its size. calibrate() times
+// each available backend (OpenMP, MPI, OpenCL) over a sweep of sizes once
+// per machine and stores, per operation, the work size from which each
+// ranking of backends applies; later calls look their size up and run on
+// the first backend in that ranking that this process can use.
+//
+// Every call is collective over the communicator given to the Dispatcher:
+// rank 0 owns the data and decides, the other ranks pass nullptr and only
+// do work when the MPI backend is chosen. With a single rank the MPI
+// backend is simply unavailable.
+//
+// Build with mpic++ -fopenmp; define DISPATCH_OPENCL and link -lOpenCL to
+// add the OpenCL backend.
+
+#include <mpi.h>
+#include <omp.h>
+#include <time.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef DISPATCH_OPENCL
+#define CL_TARGET_OPENCL_VERSION 300
+#include <CL/cl.h>
+#endif
+
+#include "stencil.hpp"
+
+namespace dispatch {
+
+enum class Backend { OpenMP = 0, MPI = 1, OpenCL = 2 };
+constexpr int kBackendCount = 3;
+
+enum class Op { Sum = 0, GradientX = 1, Gemm = 2, GemmBatched = 3, ReduceBatched = 4 };
+constexpr int kOpCount = 5;
+
+inline const char* to_string(Backend b) {
+    switch (b) {
+        case Backend::OpenMP: return "openmp";
+        case Backend::MPI:    return "mpi";
+        case Backend::OpenCL: return "opencl";
+    }
+    return "?";
+}
+
+inline const char* to_string(Op op) {
+    switch (op) {
+        case Op::Sum:       return "sum";
+        case Op::GradientX: return "gradient_x";
+        case Op::Gemm:      return "gemm";
+        case Op::GemmBatched:   return "gemm_batched";
+        case Op::ReduceBatched: return "reduce_batched";
+    }
+    return "?";
+}
+
+inline bool parse_backend(const std::string& s, Backend& out) {
+    for (int b = 0; b < kBackendCount; ++b) {
+        if (s == to_string(static_cast<Backend>(b))) { out = static_cast<Backend>(b); return true; }
+    }
+    return false;
+}
+
+inline bool parse_op(const std::string& s, Op& out) {
+    for (int op = 0; op < kOpCount; ++op) {
+        if (s == to_string(static_cast<Op>(op))) { out = static_cast<Op>(op); return true; }
+    }
+    return false;
+}
+
+// Size used for routing: elements for sum, grid points for gradient_x and
+// multiply-adds for an (m x k) * (k x n) gemm; the batched forms take the
+// problem count first and count the whole batch.
+inline double work_of(Op op, const long long d[4]) {
+    switch (op) {
+        case Op::Sum:           return double(d[0]);
+        case Op::GradientX:     return double(d[0]) * d[1];
+        case Op::Gemm:          return double(d[0]) * d[1] * d[2];
+        case Op::GemmBatched:   return double(d[0]) * d[1] * d[2] * d[3];
+        case Op::ReduceBatched: return double(d[0]) * d[1];
+    }
+    return 0.0;
+}
+
+// --- Crossover table --------------------------------------------------------
+
+constexpr const char* kDefaultTablePath = "../dispatch_table.txt";
+
+// From `work` up to the next threshold, try backends in `order`.
+struct Threshold {
+    double work = 0.0;
+    std::vector<Backend> order;
+};
+
+struct Table {
+    std::vector<Threshold> ops[kOpCount];
+    int measuredRanks = 0;
+
+    bool empty() const {
+        for (const auto& t : ops) {
+            if (!t.empty()) return false;
+        }
+        return true;
+    }
+};
+
+// The table lives next to the tasks unless DISPATCH_TABLE points elsewhere.
+inline std::string table_path() {
+    const char* env = std::getenv("DISPATCH_TABLE");
+    return env ? env : kDefaultTablePath;
+}
+
+// One line per threshold: <op>.<work>=<backend>,<backend>,...
+inline bool save_table(const Table& t, const std::string& path) {
+    std::ofstream out(path);
+    if (!out) return false;
+    for (int op = 0; op < kOpCount; ++op) {
+        for (const auto& th : t.ops[op]) {
+            char work[32];
+            std::snprintf(work, sizeof(work), "%.0f", th.work);
+            out << to_string(static_cast<Op>(op)) << "." << work << "=";
+            for (size_t i = 0; i < th.order.size(); ++i) {
+                out << (i ? "," : "") << to_string(th.order[i]);
+            }
+            out << "\n";
+        }
+    }
+    out << "ranks=" << t.measuredRanks << "\n";
+    return static_cast<bool>(out);
+}
+
+inline bool load_table(Table& t, const std::string& path) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        auto eq = line.find('=');
+        if (eq == std::string::npos) continue;
+        std::string key = line.substr(0, eq);
+        std::string value = line.substr(eq + 1);
+        if (key == "ranks") {
+            t.measuredRanks = std::atoi(value.c_str());
+            continue;
+        }
+        auto dot = key.find('.');
+        Op op;
+        if (dot == std::string::npos || !parse_op(key.substr(0, dot), op)) continue;
+        Threshold th;
+        th.work = std::atof(key.c_str() + dot + 1);
+        size_t start = 0;
+        while (start <= value.size()) {
+            size_t comma = value.find(',', start);
+            if (comma == std::string::npos) comma = value.size();
+            Backend b;
+            if (parse_backend(value.substr(start, comma - start), b)) th.order.push_back(b);
+            start = comma + 1;
+        }
+        if (!th.order.empty()) t.ops[static_cast<int>(op)].push_back(th);
+    }
+    for (auto& ths : t.ops) {
+        std::sort(ths.begin(), ths.end(),
+                  [](const Threshold& x, const Threshold& y) { return x.work < y.work; });
+    }
+    return !t.empty();
+}
+
+// --- Kernels shared by the CPU backends -------------------------------------
+
+inline long long sum_range(const int* data, long n) {
+    long long s = 0;
+    for (long i = 0; i < n; ++i) s += data[i];
+    return s;
+}
+
+// Rows of C = A * B for row-major A (rows x k) and B (k x n); i-k-j order so
+// the inner loop streams B and C.
+inline void gemm_rows(const double* A, const double* B, double* C, long rows, long n, long k) {
+    for (long i = 0; i < rows; ++i) {
+        double* c = C + i * n;
+        std::fill(c, c + n, 0.0);
+        for (long p = 0; p < k; ++p) {
+            const double a = A[i * k + p];
+            const double* b = B + p * n;
+            for (long j = 0; j < n; ++j) c[j] += a * b[j];
+        }
+    }
+}
+
+// `count` independent gemms stored back to back: problem p uses A + p*m*k,
+// B + p*k*n and C + p*m*n.
+inline void gemm_batch_range(const double* A, const double* B, double* C,
+                             long first, long last, long m, long n, long k) {
+    for (long p = first; p < last; ++p) {
+        gemm_rows(A + p * m * k, B + p * k * n, C + p * m * n, m, n, k);
+    }
+}
+
+// --- OpenCL backend ---------------------------------------------------------
+
+#ifdef DISPATCH_OPENCL
+// Context, queue and the kernels, built once. ok() is false when the
+// machine has no usable OpenCL device.
+class OpenCLBackend {
+public:
+    OpenCLBackend() { ok_ = init(); }
+    OpenCLBackend(const OpenCLBackend&) = delete;
+    OpenCLBackend& operator=(const OpenCLBackend&) = delete;
+    ~OpenCLBackend() {
+        for (cl_kernel k : {sum_, gradient_, gemm_, gemmBatched_, reduceBatched_}) {
+            if (k) clReleaseKernel(k);
+        }
+        if (program_) clReleaseProgram(program_);
+        if (queue_) clReleaseCommandQueue(queue_);
+        if (context_) clReleaseContext(context_);
+    }
+
+    bool ok() const { return ok_; }
+
+    // Each call returns false when a buffer cannot be allocated or a
+    // command fails; the dispatcher then runs the operation on OpenMP.
+    bool sum(const int* data, long n, long long& total) {
+        constexpr size_t kLocal = 64, kGroups = 64;
+        Buffers buffers(context_);
+        cl_mem in = buffers.add(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(int) * std::max(n, 1L), data);
+        cl_mem partial = buffers.add(CL_MEM_WRITE_ONLY, sizeof(cl_long) * kGroups);
+        if (!buffers.ok()) return false;
+        cl_long count = n;
+        clSetKernelArg(sum_, 0, sizeof(cl_mem), &in);
+        clSetKernelArg(sum_, 1, sizeof(cl_long), &count);
+        clSetKernelArg(sum_, 2, sizeof(cl_mem), &partial);
+        clSetKernelArg(sum_, 3, sizeof(cl_long) * kLocal, nullptr);
+        size_t global = kLocal * kGroups, local = kLocal;
+        std::vector<cl_long> sums(kGroups);
+        if (!run(sum_, 1, &global, &local, partial, sizeof(cl_long) * kGroups, sums.data())) return false;
+        total = 0;
+        for (cl_long s : sums) total += s;
+        return true;
+    }
+
+    bool gradient_x(const double* in, double* out, int rows, int cols, double h) {
+        size_t bytes = sizeof(double) * rows * cols;
+        Buffers buffers(context_);
+        cl_mem src = buffers.add(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, in);
+        cl_mem dst = buffers.add(CL_MEM_WRITE_ONLY, bytes);
+        if (!buffers.ok()) return false;
+        clSetKernelArg(gradient_, 0, sizeof(cl_mem), &src);
+        clSetKernelArg(gradient_, 1, sizeof(cl_mem), &dst);
+        clSetKernelArg(gradient_, 2, sizeof(int), &rows);
+        clSetKernelArg(gradient_, 3, sizeof(int), &cols);
+        clSetKernelArg(gradient_, 4, sizeof(double), &h);
+        clSetKernelArg(gradient_, 5, sizeof(double), &h);
+        size_t global[2] = {static_cast<size_t>(cols), static_cast<size_t>(rows)};
+        return run(gradient_, 2, global, nullptr, dst, bytes, out);
+    }
+
+    bool gemm(const double* A, const double* B, double* C, int m, int n, int k) {
+        Buffers buffers(context_);
+        cl_mem a = buffers.add(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(double) * m * k, A);
+        cl_mem b = buffers.add(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(double) * k * n, B);
+        cl_mem c = buffers.add(CL_MEM_WRITE_ONLY, sizeof(double) * m * n);
+        if (!buffers.ok()) return false;
+        clSetKernelArg(gemm_, 0, sizeof(cl_mem), &a);
+        clSetKernelArg(gemm_, 1, sizeof(cl_mem), &b);
+        clSetKernelArg(gemm_, 2, sizeof(cl_mem), &c);
+        clSetKernelArg(gemm_, 3, sizeof(int), &m);
+        clSetKernelArg(gemm_, 4, sizeof(int), &n);
+        clSetKernelArg(gemm_, 5, sizeof(int), &k);
+        size_t global[2] = {static_cast<size_t>(n), static_cast<size_t>(m)};
+        return run(gemm_, 2, global, nullptr, c, sizeof(double) * m * n, C);
+    }
+
+    // One launch for the whole batch, one work-group per problem; the
+    // group's work-items stride over that problem's outputs.
+    bool gemm_batched(const double* A, const double* B, double* C, int count, int m, int n, int k) {
+        constexpr size_t kLocal = 64;
+        size_t sa = sizeof(double) * count * m * k, sb = sizeof(double) * count * k * n;
+        size_t sc = sizeof(double) * count * m * n;
+        Buffers buffers(context_);
+        cl_mem a = buffers.add(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sa, A);
+        cl_mem b = buffers.add(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sb, B);
+        cl_mem c = buffers.add(CL_MEM_WRITE_ONLY, sc);
+        if (!buffers.ok()) return false;
+        clSetKernelArg(gemmBatched_, 0, sizeof(cl_mem), &a);
+        clSetKernelArg(gemmBatched_, 1, sizeof(cl_mem), &b);
+        clSetKernelArg(gemmBatched_, 2, sizeof(cl_mem), &c);
+        clSetKernelArg(gemmBatched_, 3, sizeof(int), &m);
+        clSetKernelArg(gemmBatched_, 4, sizeof(int), &n);
+        clSetKernelArg(gemmBatched_, 5, sizeof(int), &k);
+        size_t global = kLocal * count, local = kLocal;
+        return run(gemmBatched_, 1, &global, &local, c, sc, C);
+    }
+
+    bool reduce_batched(const int* data, long long* out, int count, int len) {
+        constexpr size_t kLocal = 64;
+        Buffers buffers(context_);
+        cl_mem in = buffers.add(CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(int) * count * len, data);
+        cl_mem sums = buffers.add(CL_MEM_WRITE_ONLY, sizeof(cl_long) * count);
+        if (!buffers.ok()) return false;
+        clSetKernelArg(reduceBatched_, 0, sizeof(cl_mem), &in);
+        clSetKernelArg(reduceBatched_, 1, sizeof(int), &len);
+        clSetKernelArg(reduceBatched_, 2, sizeof(cl_mem), &sums);
+        clSetKernelArg(reduceBatched_, 3, sizeof(cl_long) * kLocal, nullptr);
+        size_t global = kLocal * count, local = kLocal;
+        std::vector<cl_long> host(count);
+        if (!run(reduceBatched_, 1, &global, &local, sums, sizeof(cl_long) * count, host.data())) return false;
+        std::copy(host.begin(), host.end(), out);
+        return true;
+    }
+
+private:
+    // The device buffers of one call, released when it returns. After a
+    // failed allocation ok() is false and further add()s are skipped.
+    class Buffers {
+    public:
+        explicit Buffers(cl_context context) : context_(context) {}
+        Buffers(const Buffers&) = delete;
+        Buffers& operator=(const Buffers&) = delete;
+        ~Buffers() {
+            for (cl_mem m : mems_) clReleaseMemObject(m);
+        }
+
+        cl_mem add(cl_mem_flags flags, size_t bytes, const void* host = nullptr) {
+            if (!ok_) return nullptr;
+            cl_int err = CL_SUCCESS;
+            cl_mem m = clCreateBuffer(context_, flags, bytes, const_cast<void*>(host), &err);
+            if (err != CL_SUCCESS || !m) {
+                std::fprintf(stderr, "dispatch: clCreateBuffer of %zu bytes failed (%d), using OpenMP\n",
+                             bytes, err);
+                ok_ = false;
+                return nullptr;
+            }
+            mems_.push_back(m);
+            return m;
+        }
+
+        bool ok() const { return ok_; }
+
+    private:
+        cl_context context_;
+        std::vector<cl_mem> mems_;
+        bool ok_ = true;
+    };
+
+    // Launches `kernel` and reads `bytes` of `result` back into `out`.
+    bool run(cl_kernel kernel, cl_uint dims, const size_t* global, const size_t* local,
+             cl_mem result, size_t bytes, void* out) {
+        cl_int err = clEnqueueNDRangeKernel(queue_, kernel, dims, nullptr, global, local, 0, nullptr, nullptr);
+        if (err == CL_SUCCESS) {
+            err = clEnqueueReadBuffer(queue_, result, CL_TRUE, 0, bytes, out, 0, nullptr, nullptr);
+        }
+        if (err != CL_SUCCESS) {
+            std::fprintf(stderr, "dispatch: OpenCL launch failed (%d), using OpenMP\n", err);
+            return false;
+        }
+        return true;
+    }
+
+    static constexpr const char* kSource = R"CLC(
+__kernel void sum_ints(__global const int* in, const long n,
+                       __global long* partial, __local long* scratch) {
+    const size_t lid = get_local_id(0);
+    long acc = 0;
+    for (long i = get_global_id(0); i < n; i += get_global_size(0)) acc += in[i];
+    scratch[lid] = acc;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (size_t s = get_local_size(0) / 2; s > 0; s >>= 1) {
+        if (lid < s) scratch[lid] += scratch[lid + s];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0) partial[get_group_id(0)] = scratch[0];
+}
+
+__kernel void gemm(__global const double* A, __global const double* B, __global double* C,
+                   const int m, const int n, const int k) {
+    const int j = get_global_id(0);
+    const int i = get_global_id(1);
+    if (i >= m || j >= n) return;
+    double acc = 0.0;
+    for (int p = 0; p < k; ++p) acc += A[i * k + p] * B[p * n + j];
+    C[i * n + j] = acc;
+}
+
+__kernel void gemm_batched(__global const double* A, __global const double* B, __global double* C,
+                           const int m, const int n, const int k) {
+    const long p = get_group_id(0);
+    A += p * m * k;
+    B += p * k * n;
+    C += p * m * n;
+    for (int e = get_local_id(0); e < m * n; e += get_local_size(0)) {
+        const int i = e / n, j = e % n;
+        double acc = 0.0;
+        for (int q = 0; q < k; ++q) acc += A[i * k + q] * B[q * n + j];
+        C[e] = acc;
+    }
+}
+
+__kernel void reduce_batched(__global const int* in, const int len,
+                             __global long* out, __local long* scratch) {
+    const size_t lid = get_local_id(0);
+    in += (long)get_group_id(0) * len;
+    long acc = 0;
+    for (int i = lid; i < len; i += get_local_size(0)) acc += in[i];
+    scratch[lid] = acc;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (size_t s = get_local_size(0) / 2; s > 0; s >>= 1) {
+        if (lid < s) scratch[lid] += scratch[lid + s];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    if (lid == 0) out[get_group_id(0)] = scratch[0];
+}
+)CLC";
+
+    bool init() {
+        cl_int err;
+        cl_platform_id platform;
+        cl_device_id device;
+        if (clGetPlatformIDs(1, &platform, nullptr) != CL_SUCCESS) return false;
+        if (clGetDeviceIDs(platform, CL_DEVICE_TYPE_DEFAULT, 1, &device, nullptr) != CL_SUCCESS) return false;
+        context_ = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &err);
+        if (err != CL_SUCCESS) return false;
+        queue_ = clCreateCommandQueueWithProperties(context_, device, 0, &err);
+        if (err != CL_SUCCESS) return false;
+
+        const std::string source = stencil::opencl_source<2, stencil::Axis::X>("gradient_x") + kSource;
+        const char* text = source.c_str();
+        program_ = clCreateProgramWithSource(context_, 1, &text, nullptr, &err);
+        if (err != CL_SUCCESS) return false;
+        if (clBuildProgram(program_, 1, &device, nullptr, nullptr, nullptr) != CL_SUCCESS) {
+            size_t logSize = 0;
+            clGetProgramBuildInfo(program_, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &logSize);
+            std::vector<char> log(logSize + 1);
+            clGetProgramBuildInfo(program_, device, CL_PROGRAM_BUILD_LOG, logSize, log.data(), nullptr);
+            std::fprintf(stderr, "dispatch: OpenCL build failed:\n%s\n", log.data());
+            return false;
+        }
+        sum_ = clCreateKernel(program_, "sum_ints", &err);
+        if (err != CL_SUCCESS) return false;
+        gradient_ = clCreateKernel(program_, "gradient_x", &err);
+        if (err != CL_SUCCESS) return false;
+        gemm_ = clCreateKernel(program_, "gemm", &err);
+        if (err != CL_SUCCESS) return false;
+        gemmBatched_ = clCreateKernel(program_, "gemm_batched", &err);
+        if (err != CL_SUCCESS) return false;
+        reduceBatched_ = clCreateKernel(program_, "reduce_batched", &err);
+        return err == CL_SUCCESS;
+    }
+
+    bool ok_ = false;
+    cl_context context_ = nullptr;
+    cl_command_queue queue_ = nullptr;
+    cl_program program_ = nullptr;
+    cl_kernel sum_ = nullptr;
+    cl_kernel gradient_ = nullptr;
+    cl_kernel gemm_ = nullptr;
+    cl_kernel gemmBatched_ = nullptr;
+    cl_kernel reduceBatched_ = nullptr;
+};
+#endif
+
+// --- Dispatcher -------------------------------------------------------------
+
+// Broadcast from rank 0 that the other ranks wait for by polling with a
+// short sleep rather than spinning, so the OpenMP team on rank 0 gets the
+// cores in the meantime. The sleep doubles up to `maxPauseNs` for callers
+// that may wait a long time.
+inline void wait_bcast(void* buf, int count, MPI_Datatype type, MPI_Comm comm,
+                       long maxPauseNs = 20000) {
+    MPI_Request req;
+    MPI_Ibcast(buf, count, type, 0, comm, &req);
+    int done = 0;
+    MPI_Test(&req, &done, MPI_STATUS_IGNORE);
+    for (long pause = 20000; !done; pause = std::min(pause * 2, maxPauseNs)) {
+        timespec ts{0, pause};
+        nanosleep(&ts, nullptr);
+        MPI_Test(&req, &done, MPI_STATUS_IGNORE);
+    }
+}
+
+class Dispatcher {
+public:
+    explicit Dispatcher(MPI_Comm comm = MPI_COMM_WORLD) : comm_(comm) {
+        MPI_Comm_rank(comm_, &rank_);
+        MPI_Comm_size(comm_, &size_);
+        int mask = 1 << static_cast<int>(Backend::OpenMP);
+        if (size_ > 1) mask |= 1 << static_cast<int>(Backend::MPI);
+#ifdef DISPATCH_OPENCL
+        if (rank_ == 0) {
+            opencl_.reset(new OpenCLBackend());
+            if (opencl_->ok()) mask |= 1 << static_cast<int>(Backend::OpenCL);
+        }
+#endif
+        MPI_Bcast(&mask, 1, MPI_INT, 0, comm_);
+        available_ = mask;
+        if (rank_ == 0) haveTable_ = load_table(table_, table_path());
+    }
+
+    int rank() const { return rank_; }
+    bool available(Backend b) const { return (available_ >> static_cast<int>(b)) & 1; }
+    bool calibrated() const { return haveTable_; }
+    const Table& table() const { return table_; }
+
+    // Route every following call to `b` (if available) instead of the table.
+    void force(Backend b) { forced_ = static_cast<int>(b); }
+    void unforce() { forced_ = -1; }
+
+    // Fastest available backend for `work`; OpenMP without a table.
+    Backend choose(Op op, double work) const {
+        const Threshold* hit = nullptr;
+        for (const auto& th : table_.ops[static_cast<int>(op)]) {
+            if (th.work <= work) hit = &th;
+        }
+        if (hit) {
+            for (Backend b : hit->order) {
+                if (available(b)) return b;
+            }
+        }
+        return Backend::OpenMP;
+    }
+
+    // Sum of n ints.
+    long long sum(const int* data, long n, Backend* used = nullptr) {
+        long long dims[4] = {n, 0, 0, 0};
+        Backend b = begin(Op::Sum, dims);
+        if (used) *used = b;
+        n = static_cast<long>(dims[0]);
+        if (b == Backend::MPI) return mpi_sum(data, n);
+        if (rank_ != 0) return 0;
+#ifdef DISPATCH_OPENCL
+        if (b == Backend::OpenCL) {
+            long long total = 0;
+            if (opencl_->sum(data, n, total)) return total;
+            if (used) *used = Backend::OpenMP;
+        }
+#endif
+        long long s = 0;
+#pragma omp parallel for reduction(+:s) schedule(static)
+        for (long i = 0; i < n; ++i) s += data[i];
+        return s;
+    }
+
+    // Order-2 x-derivative of a row-major rows x cols grid with spacing h.
+    void gradient_x(const double* in, double* out, int rows, int cols, double h,
+                    Backend* used = nullptr) {
+        long long dims[4] = {rows, cols, 0, 0};
+        Backend b = begin(Op::GradientX, dims, &h);
+        if (used) *used = b;
+        rows = static_cast<int>(dims[0]);
+        cols = static_cast<int>(dims[1]);
+        if (b == Backend::MPI) return mpi_gradient_x(in, out, rows, cols, h);
+        if (rank_ != 0) return;
+#ifdef DISPATCH_OPENCL
+        if (b == Backend::OpenCL) {
+            if (opencl_->gradient_x(in, out, rows, cols, h)) return;
+            if (used) *used = Backend::OpenMP;
+        }
+#endif
+#pragma omp parallel for schedule(static)
+        for (int r = 0; r < rows; ++r) {
+            stencil::derivative<2, stencil::Axis::X>(in, out, rows, cols, h, h, r, r + 1);
+        }
+    }
+
+    // C (m x n) = A (m x k) * B (k x n), all row-major.
+    void gemm(const double* A, const double* B, double* C, int m, int n, int k,
+              Backend* used = nullptr) {
+        long long dims[4] = {m, n, k, 0};
+        Backend b = begin(Op::Gemm, dims);
+        if (used) *used = b;
+        m = static_cast<int>(dims[0]);
+        n = static_cast<int>(dims[1]);
+        k = static_cast<int>(dims[2]);
+        if (b == Backend::MPI) return mpi_gemm(A, B, C, m, n, k);
+        if (rank_ != 0) return;
+#ifdef DISPATCH_OPENCL
+        if (b == Backend::OpenCL) {
+            if (opencl_->gemm(A, B, C, m, n, k)) return;
+            if (used) *used = Backend::OpenMP;
+        }
+#endif
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < m; ++i) {
+            gemm_rows(A + long(i) * k, B, C + long(i) * n, 1, n, k);
+        }
+    }
+
+    // `count` independent (m x k) * (k x n) products stored back to back
+    // (see gemm_batch_range). One launch, one parallel region or one packed
+    // message per rank for the whole batch.
+    void gemm_batched(const double* A, const double* B, double* C, int count, int m, int n, int k,
+                      Backend* used = nullptr) {
+        long long dims[4] = {count, m, n, k};
+        Backend b = begin(Op::GemmBatched, dims);
+        if (used) *used = b;
+        count = static_cast<int>(dims[0]);
+        m = static_cast<int>(dims[1]);
+        n = static_cast<int>(dims[2]);
+        k = static_cast<int>(dims[3]);
+        if (b == Backend::MPI) return mpi_gemm_batched(A, B, C, count, m, n, k);
+        if (rank_ != 0) return;
+#ifdef DISPATCH_OPENCL
+        if (b == Backend::OpenCL) {
+            if (opencl_->gemm_batched(A, B, C, count, m, n, k)) return;
+            if (used) *used = Backend::OpenMP;
+        }
+#endif
+#pragma omp parallel for schedule(static)
+        for (int p = 0; p < count; ++p) {
+            gemm_batch_range(A, B, C, p, p + 1, m, n, k);
+        }
+    }
+
+    // out[p] = sum of the `len` ints of problem p, stored at data + p*len.
+    void reduce_batched(const int* data, long long* out, int count, int len, Backend* used = nullptr) {
+        long long dims[4] = {count, len, 0, 0};
+        Backend b = begin(Op::ReduceBatched, dims);
+        if (used) *used = b;
+        count = static_cast<int>(dims[0]);
+        len = static_cast<int>(dims[1]);
+        if (b == Backend::MPI) return mpi_reduce_batched(data, out, count, len);
+        if (rank_ != 0) return;
+#ifdef DISPATCH_OPENCL
+        if (b == Backend::OpenCL) {
+            if (opencl_->reduce_batched(data, out, count, len)) return;
+            if (used) *used = Backend::OpenMP;
+        }
+#endif
+#pragma omp parallel for schedule(static)
+        for (int p = 0; p < count; ++p) {
+            out[p] = sum_range(data + long(p) * len, len);
+        }
+    }
+
+    // Collective. Times every available backend over a size sweep, keeps
+    // the ranking wherever the winner changes and saves the table to `path`
+    // on rank 0. The crossover is placed at the geometric mean of the two
+    // sizes on either side of it.
+    Table calibrate(const std::string& path, bool verbose = true);
+
+private:
+    // Rank 0 picks the backend; everybody learns it and the problem shape.
+    Backend begin(Op op, long long dims[4], double* scalar = nullptr) {
+        long long header[6] = {0, dims[0], dims[1], dims[2], dims[3], 0};
+        if (rank_ == 0) {
+            Backend b = forced_ >= 0 && available(static_cast<Backend>(forced_))
+                ? static_cast<Backend>(forced_)
+                : choose(op, work_of(op, dims));
+            header[0] = static_cast<long long>(b);
+            if (scalar) std::memcpy(&header[5], scalar, sizeof(double));
+        }
+        if (size_ > 1) wait_bcast(header, 6, MPI_LONG_LONG, comm_);
+        for (int i = 0; i < 4; ++i) dims[i] = header[i + 1];
+        if (scalar) std::memcpy(scalar, &header[5], sizeof(double));
+        return static_cast<Backend>(header[0]);
+    }
+
+    // Contiguous block split of `total` items; counts/displs in items * unit.
+    void split(long total, int unit, std::vector<int>& counts, std::vector<int>& displs) const {
+        counts.assign(size_, 0);
+        displs.assign(size_, 0);
+        long base = total / size_, extra = total % size_;
+        for (int r = 0, offset = 0; r < size_; ++r) {
+            counts[r] = static_cast<int>((base + (r < extra ? 1 : 0)) * unit);
+            displs[r] = offset;
+            offset += counts[r];
+        }
+    }
+
+    long long mpi_sum(const int* data, long n) {
+        std::vector<int> counts, displs;
+        split(n, 1, counts, displs);
+        std::vector<int> mine(counts[rank_]);
+        MPI_Scatterv(data, counts.data(), displs.data(), MPI_INT,
+                     mine.data(), counts[rank_], MPI_INT, 0, comm_);
+        long long partial = sum_range(mine.data(), counts[rank_]), total = 0;
+        MPI_Reduce(&partial, &total, 1, MPI_LONG_LONG, MPI_SUM, 0, comm_);
+        return total;
+    }
+
+    void mpi_gradient_x(const double* in, double* out, int rows, int cols, double h) {
+        std::vector<int> counts, displs;
+        split(rows, cols, counts, displs);
+        int myRows = counts[rank_] / cols;
+        std::vector<double> src(counts[rank_]), dst(counts[rank_]);
+        MPI_Scatterv(in, counts.data(), displs.data(), MPI_DOUBLE,
+                     src.data(), counts[rank_], MPI_DOUBLE, 0, comm_);
+        stencil::derivative<2, stencil::Axis::X>(src.data(), dst.data(), myRows, cols, h, h, 0, myRows);
+        MPI_Gatherv(dst.data(), counts[rank_], MPI_DOUBLE,
+                    out, counts.data(), displs.data(), MPI_DOUBLE, 0, comm_);
+    }
+
+    void mpi_gemm(const double* A, const double* B, double* C, int m, int n, int k) {
+        std::vector<int> countsA, displsA, countsC, displsC;
+        split(m, k, countsA, displsA);
+        split(m, n, countsC, displsC);
+        int myRows = k > 0 ? countsA[rank_] / k : 0;
+        std::vector<double> a(countsA[rank_]), c(countsC[rank_]);
+        std::vector<double> b;
+        if (rank_ != 0) b.resize(static_cast<size_t>(k) * n);
+        MPI_Scatterv(A, countsA.data(), displsA.data(), MPI_DOUBLE,
+                     a.data(), countsA[rank_], MPI_DOUBLE, 0, comm_);
+        MPI_Bcast(rank_ == 0 ? const_cast<double*>(B) : b.data(), k * n, MPI_DOUBLE, 0, comm_);
+        gemm_rows(a.data(), rank_ == 0 ? B : b.data(), c.data(), myRows, n, k);
+        MPI_Gatherv(c.data(), countsC[rank_], MPI_DOUBLE,
+                    C, countsC.data(), displsC.data(), MPI_DOUBLE, 0, comm_);
+    }
+
+    // Each rank gets a contiguous block of problems: one Scatterv each for
+    // the packed A and B blocks and one Gatherv for C, however many
+    // problems there are.
+    void mpi_gemm_batched(const double* A, const double* B, double* C, int count, int m, int n, int k) {
+        std::vector<int> countsA, displsA, countsB, displsB, countsC, displsC;
+        split(count, m * k, countsA, displsA);
+        split(count, k * n, countsB, displsB);
+        split(count, m * n, countsC, displsC);
+        int mine = m * k > 0 ? countsA[rank_] / (m * k) : 0;
+        std::vector<double> a(countsA[rank_]), b(countsB[rank_]), c(countsC[rank_]);
+        MPI_Scatterv(A, countsA.data(), displsA.data(), MPI_DOUBLE,
+                     a.data(), countsA[rank_], MPI_DOUBLE, 0, comm_);
+        MPI_Scatterv(B, countsB.data(), displsB.data(), MPI_DOUBLE,
+                     b.data(), countsB[rank_], MPI_DOUBLE, 0, comm_);
+        gemm_batch_range(a.data(), b.data(), c.data(), 0, mine, m, n, k);
+        MPI_Gatherv(c.data(), countsC[rank_], MPI_DOUBLE,
+                    C, countsC.data(), displsC.data(), MPI_DOUBLE, 0, comm_);
+    }
+
+    void mpi_reduce_batched(const int* data, long long* out, int count, int len) {
+        std::vector<int> countsIn, displsIn, countsOut, displsOut;
+        split(count, len, countsIn, displsIn);
+        split(count, 1, countsOut, displsOut);
+        std::vector<int> in(countsIn[rank_]);
+        std::vector<long long> sums(countsOut[rank_]);
+        MPI_Scatterv(data, countsIn.data(), displsIn.data(), MPI_INT,
+                     in.data(), countsIn[rank_], MPI_INT, 0, comm_);
+        for (int p = 0; p < countsOut[rank_]; ++p) sums[p] = sum_range(in.data() + long(p) * len, len);
+        MPI_Gatherv(sums.data(), countsOut[rank_], MPI_LONG_LONG,
+                    out, countsOut.data(), displsOut.data(), MPI_LONG_LONG, 0, comm_);
+    }
+
+    MPI_Comm comm_;
+    int rank_ = 0;
+    int size_ = 1;
+    int available_ = 0;
+    int forced_ = -1;
+    bool haveTable_ = false;
+    Table table_;
+#ifdef DISPATCH_OPENCL
+    std::unique_ptr<OpenCLBackend> opencl_;  // rank 0 only
+#endif
+};
+
+// Sizes the calibration sweeps: element counts for sum, square grid and
+// matrix edges for gradient_x and gemm, and problem counts for the batched
+// forms, whose problems are kBatchEdge elements or kBatchEdge^2 matrices.
+constexpr int kBatchEdge = 10;
+
+inline std::vector<long> calibration_sizes(Op op) {
+    switch (op) {
+        case Op::Sum:           return {10, 100, 1000, 10000, 100000, 1000000, 10000000};
+        case Op::GradientX:     return {10, 32, 100, 316, 1000, 2000};
+        case Op::Gemm:          return {10, 32, 100, 316, 1000};
+        case Op::GemmBatched:   return {16, 256, 4096, 65536};
+        case Op::ReduceBatched: return {16, 256, 4096, 65536, 1048576};
+    }
+    return {};
+}
+
+inline Table Dispatcher::calibrate(const std::string& path, bool verbose) {
+    Table result;
+    result.measuredRanks = size_;
+    const int savedForce = forced_;
+
+    for (int o = 0; o < kOpCount; ++o) {
+        const Op op = static_cast<Op>(o);
+        double lastWork = 0.0;
+        for (long n : calibration_sizes(op)) {
+            const int e = kBatchEdge;
+            long long dims[4] = {n, n, n, 0};
+            if (op == Op::GemmBatched) { dims[1] = dims[2] = dims[3] = e; }
+            if (op == Op::ReduceBatched) { dims[1] = e; }
+            const double work = work_of(op, dims);
+            // Same deterministic repeat count on every rank.
+            const int reps = work < 1e6 ? 7 : work < 1e8 ? 3 : 1;
+
+            std::vector<int> ints;
+            std::vector<long long> sums;
+            std::vector<double> x, y, z;
+            if (rank_ == 0) {
+                if (op == Op::Sum || op == Op::ReduceBatched) {
+                    ints.resize(op == Op::Sum ? n : n * e);
+                    for (size_t i = 0; i < ints.size(); ++i) ints[i] = static_cast<int>(i % 10);
+                    sums.resize(n);
+                } else {
+                    const long elements = op == Op::GemmBatched ? n * e * e : n * n;
+                    x.resize(elements);
+                    y.resize(elements);
+                    z.resize(elements);
+                    for (long i = 0; i < elements; ++i) x[i] = y[i] = static_cast<double>(i % 10);
+                }
+            }
+
+            double best[kBackendCount];
+            std::fill(best, best + kBackendCount, std::numeric_limits<double>::infinity());
+            for (int bi = 0; bi < kBackendCount; ++bi) {
+                if (!available(static_cast<Backend>(bi))) continue;
+                force(static_cast<Backend>(bi));
+                for (int rep = 0; rep < reps; ++rep) {
+                    MPI_Barrier(comm_);
+                    double t0 = MPI_Wtime();
+                    const int ni = static_cast<int>(n);
+                    switch (op) {
+                        case Op::Sum:           sum(ints.data(), n); break;
+                        case Op::GradientX:     gradient_x(x.data(), z.data(), ni, ni, 0.01); break;
+                        case Op::Gemm:          gemm(x.data(), y.data(), z.data(), ni, ni, ni); break;
+                        case Op::GemmBatched:   gemm_batched(x.data(), y.data(), z.data(), ni, e, e, e); break;
+                        case Op::ReduceBatched: reduce_batched(ints.data(), sums.data(), ni, e); break;
+                    }
+                    best[bi] = std::min(best[bi], MPI_Wtime() - t0);
+                }
+            }
+
+            if (rank_ != 0) continue;
+            Threshold th;
+            th.work = work;
+            for (int bi = 0; bi < kBackendCount; ++bi) {
+                if (available(static_cast<Backend>(bi))) th.order.push_back(static_cast<Backend>(bi));
+            }
+            std::sort(th.order.begin(), th.order.end(), [&](Backend a, Backend b) {
+                return best[static_cast<int>(a)] < best[static_cast<int>(b)];
+            });
+            auto& list = result.ops[o];
+            if (list.empty()) {
+                th.work = 0.0;
+                list.push_back(th);
+            } else if (list.back().order.front() != th.order.front()) {
+                th.work = std::sqrt(lastWork * work);
+                list.push_back(th);
+            }
+            lastWork = work;
+
+            if (verbose) {
+                std::printf("[calibrate] %s n=%ld:", to_string(op), n);
+                for (Backend b : th.order) std::printf(" %s %.3g s", to_string(b), best[static_cast<int>(b)]);
+                std::printf(" -> %s\n", to_string(th.order.front()));
+                std::fflush(stdout);
+            }
+        }
+    }
+
+    forced_ = savedForce;
+    if (rank_ == 0) {
+        table_ = result;
+        haveTable_ = true;
+        if (!save_table(result, path)) {
+            std::fprintf(stderr, "dispatch: could not write %s\n", path.c_str());
+        }
+    }
+    return result;
+}
+
+} // namespace dispatch
@@ -0,0 +1,169 @@
+#pragma once
+
+// NUMA placement helpers shared by the OpenMP and MPI programs.
+//
+// Pages land on the node of the thread that first writes them, so buffers
+// are allocated untouched (FirstTouchAllocator) and filled by the same
+// static schedule that later computes on them. With libnuma (make NUMA=1)
+// NUMA_POLICY=interleave|bind:<node> switches the whole process to an
+// explicit policy instead.
+
+#include <sched.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+namespace numa {
+
+// std::allocator that default-initialises instead of value-initialising, so
+// `std::vector<T, FirstTouchAllocator<T>> v(n)` maps no pages until the
+// owning threads write them.
+template <typename T>
+struct FirstTouchAllocator : std::allocator<T> {
+    template <typename U>
+    struct rebind { using other = FirstTouchAllocator<U>; };
+
+    FirstTouchAllocator() = default;
+    template <typename U>
+    FirstTouchAllocator(const FirstTouchAllocator<U>&) noexcept {}
+
+    template <typename U>
+    void construct(U* p) noexcept(std::is_nothrow_default_constructible<U>::value) {
+        ::new (static_cast<void*>(p)) U;
+    }
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+};
+
+// Counter-based generator (splitmix64) for first-touch fills: element i
+// does not depend on the elements before it, so every thread can fill its
+// own slice. Returns a value in [0, maxVal).
+inline int random_at(std::uint64_t seed, std::uint64_t i, int maxVal) {
+    std::uint64_t z = seed + (i + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    return static_cast<int>(z % static_cast<std::uint64_t>(maxVal));
+}
+
+// Package (socket) id of a logical CPU, from sysfs; 0 when unknown.
+inline int socket_of_cpu(int cpu) {
+    if (cpu < 0) return 0;
+    std::ifstream in("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/physical_package_id");
+    int socket = 0;
+    return (in >> socket) ? socket : 0;
+}
+
+inline int current_socket() {
+    return socket_of_cpu(sched_getcpu());
+}
+
+// OpenMP reads OMP_PLACES / OMP_PROC_BIND once, before main(), so the
+// binding has to come from the launcher: the Makefiles' run_openmp passes
+// OMP_PLACES=cores OMP_PROC_BIND=spread by default. Warns when the program
+// was started without either, since first-touch placement then depends on
+// where the scheduler happens to move the threads.
+inline void check_binding() {
+    if (!std::getenv("OMP_PLACES") && !std::getenv("OMP_PROC_BIND")) {
+        std::fprintf(stderr, "OMP_PLACES/OMP_PROC_BIND unset: threads are not bound "
+                             "(make run_openmp sets them)\n");
+    }
+}
+
+inline std::string describe_binding() {
+    const char* places = std::getenv("OMP_PLACES");
+    const char* bind = std::getenv("OMP_PROC_BIND");
+    return std::string("OMP_PLACES=") + (places ? places : "unset")
+         + " OMP_PROC_BIND=" + (bind ? bind : "unset");
+}
+
+// Applies NUMA_POLICY for the rest of the process and returns a short
+// description for the benchmark output.
+inline std::string apply_policy() {
+    const char* env = std::getenv("NUMA_POLICY");
+    std::string policy = env ? env : "firsttouch";
+#ifdef HAVE_LIBNUMA
+    if (numa_available() < 0) {
+        return "firsttouch (no NUMA support)";
+    }
+    if (policy == "interleave") {
+        numa_set_interleave_mask(numa_all_nodes_ptr);
+        return policy;
+    }
+    if (policy.rfind("bind:", 0) == 0) {
+        int node = std::atoi(policy.c_str() + 5);
+        bitmask* nodes = numa_allocate_nodemask();
+        numa_bitmask_setbit(nodes, node);
+        numa_set_membind(nodes);
+        numa_free_nodemask(nodes);
+        return policy;
+    }
+#else
+    if (policy != "firsttouch") {
+        std::fprintf(stderr, "NUMA_POLICY=%s needs a libnuma build (make NUMA=1), using firsttouch\n",
+                     policy.c_str());
+    }
+#endif
+    return "firsttouch";
+}
+
+// Accumulates per-socket bytes and seconds from many threads.
+class SocketBandwidth {
+public:
+    void add(int socket, double bytes, double seconds) {
+        auto& s = sockets_[socket];
+        s.bytes += bytes;
+        s.seconds = std::max(s.seconds, seconds);
+    }
+
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (const auto& [socket, s] : sockets_) {
+            fn(socket, s.seconds > 0 ? s.bytes / s.seconds / 1e9 : 0.0);
+        }
+    }
+
+private:
+    struct Totals {
+        double bytes = 0.0;
+        double seconds = 0.0;
+    };
+    std::map<int, Totals> sockets_;
+};
+
+#ifdef MPI_VERSION
+// Prints which socket every rank of `comm` runs on (on rank 0), to check the
+// mpiexec mapping (MPI_MAP in the Makefiles).
+inline void report_rank_sockets(MPI_Comm comm) {
+    int rank = 0, size = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int socket = current_socket();
+    std::unique_ptr<int[]> sockets(new int[size]);
+    MPI_Gather(&socket, 1, MPI_INT, sockets.get(), 1, MPI_INT, 0, comm);
+    if (rank == 0) {
+        std::printf("Rank->socket:");
+        for (int r = 0; r < size; ++r) {
+            std::printf(" %d:%d", r, sockets[r]);
+        }
+        std::printf("\n");
+        std::fflush(stdout);
+    }
+}
+#endif
+
+} // namespace numa
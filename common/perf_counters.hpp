@@ -0,0 +1,429 @@
+#pragma once
+
+// Hardware-counter instrumentation for the timed regions, on top of Linux
+// perf_event_open. Counters are per thread (OpenMP) or per rank (MPI); each
+// region is reported against measured machine peaks as a roofline point.
+//
+// Counters the kernel or the virtual machine does not expose are reported
+// as "n/a" and the roofline falls back to the algorithmic byte count.
+
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#define PERF_OMP(directive) _Pragma(#directive)
+#else
+#include <thread>
+#define PERF_OMP(directive)
+#endif
+
+namespace perf {
+
+enum Event { kCycles, kInstructions, kLlcMisses, kPageFaults, kDtlbMisses, kEventCount };
+
+constexpr double kCacheLineBytes = 64.0;
+
+struct EventSpec {
+    const char* name;
+    std::uint32_t type;
+    std::uint64_t config;
+};
+
+inline const EventSpec& spec(int e) {
+    static const EventSpec kSpecs[kEventCount] = {
+        {"cycles",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {"llc-misses",   PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {"page-faults",  PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+        {"dtlb-misses",  PERF_TYPE_HW_CACHE,
+         PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    };
+    return kSpecs[e];
+}
+
+// One reading of every event; a negative value means "not available".
+struct Counts {
+    double value[kEventCount];
+
+    Counts() { std::fill(value, value + kEventCount, -1.0); }
+
+    bool has(int e) const { return value[e] >= 0; }
+
+    Counts operator-(const Counts& before) const {
+        Counts d;
+        for (int e = 0; e < kEventCount; ++e) {
+            if (has(e) && before.has(e)) d.value[e] = value[e] - before.value[e];
+        }
+        return d;
+    }
+
+    Counts& operator+=(const Counts& other) {
+        for (int e = 0; e < kEventCount; ++e) {
+            if (other.has(e)) value[e] = std::max(value[e], 0.0) + other.value[e];
+        }
+        return *this;
+    }
+};
+
+// Counters of the calling thread. Readable from any thread once opened.
+class ThreadCounters {
+public:
+    ThreadCounters() { std::fill(fd_, fd_ + kEventCount, -1); }
+    ThreadCounters(const ThreadCounters&) = delete;
+    ThreadCounters& operator=(const ThreadCounters&) = delete;
+    ~ThreadCounters() {
+        for (int fd : fd_) {
+            if (fd >= 0) close(fd);
+        }
+    }
+
+    void open() {
+        for (int e = 0; e < kEventCount; ++e) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = spec(e).type;
+            attr.config = spec(e).config;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fd_[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+    }
+
+    // Values are scaled up when the kernel had to multiplex the counters.
+    Counts read() const {
+        Counts c;
+        for (int e = 0; e < kEventCount; ++e) {
+            std::uint64_t buf[3];
+            if (fd_[e] < 0 || ::read(fd_[e], buf, sizeof(buf)) != sizeof(buf)) continue;
+            double scale = buf[2] > 0 ? static_cast<double>(buf[1]) / buf[2] : 1.0;
+            c.value[e] = static_cast<double>(buf[0]) * scale;
+        }
+        return c;
+    }
+
+private:
+    int fd_[kEventCount];
+};
+
+// One set of counters per OpenMP thread (a single set without OpenMP).
+// Relies on the runtime keeping the same worker threads between regions,
+// which every mainstream OpenMP implementation does.
+class Team {
+public:
+    Team() {
+#ifdef _OPENMP
+        threads_ = std::vector<ThreadCounters>(omp_get_max_threads());
+#pragma omp parallel
+        threads_[omp_get_thread_num()].open();
+#else
+        threads_ = std::vector<ThreadCounters>(1);
+        threads_[0].open();
+#endif
+    }
+
+    std::vector<Counts> sample() const {
+        std::vector<Counts> out;
+        for (const auto& t : threads_) out.push_back(t.read());
+        return out;
+    }
+
+private:
+    std::vector<ThreadCounters> threads_;
+};
+
+inline std::vector<Counts> operator-(const std::vector<Counts>& after, const std::vector<Counts>& before) {
+    std::vector<Counts> d(after.size());
+    for (size_t i = 0; i < after.size(); ++i) d[i] = after[i] - before[i];
+    return d;
+}
+
+// --- Machine peaks ----------------------------------------------------------
+
+// The peak kernels are built with the same flags as the program that
+// includes this header, so a region is compared against a peak compiled
+// the way it was.
+
+inline double clock_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct Peaks {
+    double gflops = 0.0;   // 0 when the kernel's operations have no measured peak
+    double gbytes = 0.0;
+
+    double ridge() const { return gbytes > 0 ? gflops / gbytes : 0.0; }
+
+    // Share of the machine available to `part` of `whole` ranks or threads.
+    Peaks share(int part, int whole) const {
+        double f = whole > 0 ? double(part) / whole : 1.0;
+        return Peaks{gflops * f, gbytes * f};
+    }
+
+    // For integer kernels: the FMA peak is a double-precision rate, so only
+    // the bandwidth roof applies to them.
+    Peaks memory_only() const { return Peaks{0.0, gbytes}; }
+};
+
+// CPUs each thread of run_team runs on; empty keeps the inherited binding.
+using CpuSets = std::vector<cpu_set_t>;
+
+// Runs f(thread, threads) on `threads` threads: an OpenMP team when built
+// with OpenMP, std::threads otherwise (the MPI node leader, whose helper
+// thread t takes the CPUs of node rank t).
+template <typename F>
+void run_team(int threads, const CpuSets& cpus, F f) {
+#ifdef _OPENMP
+    (void)cpus;
+PERF_OMP(omp parallel num_threads(threads))
+    f(omp_get_thread_num(), omp_get_num_threads());
+#else
+    std::vector<std::thread> team;
+    for (int t = 1; t < threads; ++t) {
+        team.emplace_back([&, t] {
+            if (t < static_cast<int>(cpus.size())) sched_setaffinity(0, sizeof(cpu_set_t), &cpus[t]);
+            f(t, threads);
+        });
+    }
+    f(0, threads);
+    for (auto& th : team) th.join();
+#endif
+}
+
+// Spin barrier for the peak kernels: round r releases once every thread
+// has arrived r times.
+class Gate {
+public:
+    explicit Gate(int threads) : threads_(threads) {}
+    void wait(int round) {
+        arrived_.fetch_add(1);
+        while (arrived_.load() < threads_ * round) sched_yield();
+    }
+
+private:
+    int threads_;
+    std::atomic<int> arrived_{0};
+};
+
+inline int default_threads() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// Independent FMA chains on every thread: attainable double-precision rate.
+inline double measure_peak_gflops(int threads, const CpuSets& cpus) {
+    constexpr int kChains = 16;
+    constexpr long kIters = 1L << 22;
+    std::vector<double> seconds(threads), sink(threads);
+    Gate gate(threads);
+    run_team(threads, cpus, [&](int t, int) {
+        double acc[kChains];
+        for (int c = 0; c < kChains; ++c) acc[c] = 1.0 + c * 1e-9;
+        gate.wait(1);
+        double t0 = clock_seconds();
+        for (long i = 0; i < kIters; ++i) {
+            for (int c = 0; c < kChains; ++c) acc[c] = acc[c] * 0.9999999 + 1e-7;
+        }
+        seconds[t] = clock_seconds() - t0;
+        for (int c = 0; c < kChains; ++c) sink[t] += acc[c];
+    });
+    volatile double keep = sink[0];
+    (void)keep;
+    return 2.0 * kChains * kIters * threads / *std::max_element(seconds.begin(), seconds.end()) / 1e9;
+}
+
+// Last-level cache size in bytes, or 0 when the system does not say.
+inline long llc_bytes() {
+    long bytes = 0;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    bytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    for (int index = 3; bytes <= 0 && index >= 2; --index) {
+        std::string path = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index) + "/size";
+        if (std::FILE* f = std::fopen(path.c_str(), "r")) {
+            char unit = 0;
+            if (std::fscanf(f, "%ld%c", &bytes, &unit) >= 1) {
+                if (unit == 'K') bytes <<= 10;
+                if (unit == 'M') bytes <<= 20;
+            }
+            std::fclose(f);
+        }
+    }
+    return bytes > 0 ? bytes : 0;
+}
+
+// STREAM-style triad. Each array is four times the LLC (STREAM's rule),
+// capped so the three stay under an eighth of physical memory, and is left
+// uninitialised until every thread fills the block it later streams, so
+// pages are placed like the kernels' first-touch data.
+inline double measure_peak_gbytes(int threads, const CpuSets& cpus) {
+    constexpr long kMinElements = 1L << 20;
+    const long ramBytes = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    const long cap = std::max(kMinElements, ramBytes / 8 / 3 / long(sizeof(double)));
+    const long n = std::min(cap, std::max(kMinElements, 4 * llc_bytes() / long(sizeof(double))));
+    std::unique_ptr<double[]> a(new double[n]), b(new double[n]), c(new double[n]);
+    std::vector<double> best(threads, 1e30);
+    Gate gate(threads);
+    run_team(threads, cpus, [&](int t, int team) {
+        const long lo = n * t / team, hi = n * (t + 1) / team;
+        double* __restrict__ pa = a.get();
+        const double* __restrict__ pb = b.get();
+        const double* __restrict__ pc = c.get();
+        for (long i = lo; i < hi; ++i) {
+            a[i] = 0.0;
+            b[i] = 1.0;
+            c[i] = 2.0;
+        }
+        for (int rep = 0; rep < 3; ++rep) {
+            gate.wait(rep + 1);
+            double t0 = clock_seconds();
+            for (long i = lo; i < hi; ++i) pa[i] = pb[i] + 3.0 * pc[i];
+            best[t] = std::min(best[t], clock_seconds() - t0);
+        }
+    });
+    return 3.0 * sizeof(double) * n / *std::max_element(best.begin(), best.end()) / 1e9;
+}
+
+inline Peaks measure_peaks(int threads = default_threads(), const CpuSets& cpus = {}) {
+    Peaks p;
+    p.gflops = measure_peak_gflops(threads, cpus);
+    p.gbytes = measure_peak_gbytes(threads, cpus);
+    return p;
+}
+
+// --- Reporting --------------------------------------------------------------
+
+inline std::string fmt_count(const Counts& c, int e) {
+    if (!c.has(e)) return "n/a";
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.3g", c.value[e]);
+    return buf;
+}
+
+inline void print_counts(const char* who, int id, const Counts& c) {
+    std::printf("    %s %d: cycles=%s instructions=%s llc-misses=%s page-faults=%s dtlb-misses=%s",
+                who, id, fmt_count(c, kCycles).c_str(), fmt_count(c, kInstructions).c_str(),
+                fmt_count(c, kLlcMisses).c_str(), fmt_count(c, kPageFaults).c_str(),
+                fmt_count(c, kDtlbMisses).c_str());
+    if (c.has(kCycles) && c.has(kInstructions) && c.value[kCycles] > 0) {
+        std::printf(" ipc=%.2f", c.value[kInstructions] / c.value[kCycles]);
+    }
+    std::printf("\n");
+}
+
+// Roofline summary of one region: `flops` is the kernel's operation count
+// and `minBytes` the compulsory traffic, used when LLC misses are unknown.
+inline void print_region(const std::string& name, double seconds, double flops, double minBytes,
+                         const std::vector<Counts>& perThread, const Peaks& peaks,
+                         const char* who = "thread") {
+    Counts total;
+    for (const auto& c : perThread) total += c;
+
+    bool measured = total.has(kLlcMisses);
+    double bytes = measured ? total.value[kLlcMisses] * kCacheLineBytes : minBytes;
+    bytes = std::max(bytes, 1.0);
+    double intensity = flops / bytes;
+    double achieved = seconds > 0 ? flops / seconds / 1e9 : 0.0;
+    double gbs = seconds > 0 ? bytes / seconds / 1e9 : 0.0;
+    const char* source = measured ? "LLC misses" : "algorithmic";
+
+    if (peaks.gflops <= 0) {
+        // No compute peak for these operations: only the bandwidth roof.
+        double roof = intensity * peaks.gbytes;
+        std::printf("[perf] %s: %.3g s, %.3g GOP/s, %.3g GB/s (%s), AI=%.3g op/B, "
+                    "bandwidth roof=%.3g GOP/s (%.0f%%)\n",
+                    name.c_str(), seconds, achieved, gbs, source, intensity, roof,
+                    roof > 0 ? 100.0 * achieved / roof : 0.0);
+    } else {
+        double roof = std::min(peaks.gflops, intensity * peaks.gbytes);
+        std::printf("[perf] %s: %.3g s, %.3g GFLOP/s, %.3g GB/s (%s), AI=%.3g flop/B, "
+                    "roof=%.3g GFLOP/s (%.0f%%), %s-bound\n",
+                    name.c_str(), seconds, achieved, gbs, source, intensity, roof,
+                    roof > 0 ? 100.0 * achieved / roof : 0.0,
+                    intensity < peaks.ridge() ? "memory" : "compute");
+    }
+    for (size_t i = 0; i < perThread.size(); ++i) {
+        print_counts(who, static_cast<int>(i), perThread[i]);
+    }
+}
+
+inline void print_peaks(const Peaks& peaks) {
+    std::printf("[perf] machine peaks: %.3g GFLOP/s, %.3g GB/s, ridge AI=%.3g flop/B\n",
+                peaks.gflops, peaks.gbytes, peaks.ridge());
+}
+
+#ifdef MPI_VERSION
+// One rank per node measures, with a thread for every rank on the node,
+// while the others wait without spinning; the leaders' results are summed
+// into the peaks of the whole communicator and returned on every rank.
+inline Peaks measure_peaks(MPI_Comm comm) {
+    MPI_Comm node;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+    int nodeRank = 0, nodeSize = 1;
+    MPI_Comm_rank(node, &nodeRank);
+    MPI_Comm_size(node, &nodeSize);
+
+    // The leader's threads run on the node ranks' CPUs, which stay idle
+    // meanwhile, so the measurement sees the cores the kernels will use.
+    cpu_set_t mask;
+    sched_getaffinity(0, sizeof(mask), &mask);
+    CpuSets cpus(nodeRank == 0 ? nodeSize : 0);
+    MPI_Gather(&mask, sizeof(mask), MPI_BYTE, cpus.data(), sizeof(mask), MPI_BYTE, 0, node);
+
+    double local[2] = {0.0, 0.0};
+    if (nodeRank == 0) {
+        Peaks mine = measure_peaks(nodeSize, cpus);
+        local[0] = mine.gflops;
+        local[1] = mine.gbytes;
+    }
+    MPI_Request done;
+    MPI_Ibarrier(node, &done);
+    for (int flag = 0;;) {
+        MPI_Test(&done, &flag, MPI_STATUS_IGNORE);
+        if (flag) break;
+        timespec pause{0, 1'000'000};
+        nanosleep(&pause, nullptr);
+    }
+    MPI_Comm_free(&node);
+
+    double total[2] = {0.0, 0.0};
+    MPI_Allreduce(local, total, 2, MPI_DOUBLE, MPI_SUM, comm);
+    return Peaks{total[0], total[1]};
+}
+
+// Per-rank variant: gathers each rank's counter deltas on rank 0 and prints
+// one roofline line for the whole communicator.
+inline void print_region(MPI_Comm comm, const std::string& name, double seconds, double flops,
+                         double minBytes, const Counts& mine, const Peaks& peaks) {
+    int rank = 0, size = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    std::vector<Counts> all(size);
+    MPI_Gather(mine.value, kEventCount, MPI_DOUBLE,
+               reinterpret_cast<double*>(all.data()), kEventCount, MPI_DOUBLE, 0, comm);
+    if (rank == 0) {
+        print_region(name, seconds, flops, minBytes, all, peaks, "rank");
+    }
+}
+#endif
+
+} // namespace perf
@@ -0,0 +1,295 @@
+#pragma once
+
+// Wire protocol, client and latency bookkeeping for the resident service
+// (service/server.cpp). The server keeps MPI, the OpenMP team and the
+// OpenCL context alive between requests; clients talk to rank 0 over a
+// local Unix stream socket.
+//
+// Every request is a fixed Request header followed by its input arrays,
+// every reply a fixed Reply header followed by its output; both sides are
+// the same machine, so everything is in native byte order.
+//
+//   job       dims           input                        output
+//   Sum       n              n ints                       1 long long
+//   Stencil   rows, cols>=3  rows*cols doubles (h above)  rows*cols doubles
+//   Matmul    m, n, k        A m*k then B k*n doubles     C m*n doubles
+//   Stats     -              -                            report text
+//   Shutdown  -              -                            -
+//
+// Requests may be pipelined on one connection; replies come back in order.
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace service {
+
+constexpr const char* kDefaultSocketPath = "/tmp/hpc-service.sock";
+constexpr std::uint32_t kMagic = 0x48504331;  // "HPC1"
+constexpr std::int64_t kMaxPayloadBytes = std::int64_t(1) << 31;
+
+enum class Job : std::int32_t { Sum = 0, Stencil = 1, Matmul = 2, Stats = 3, Shutdown = 4 };
+constexpr int kJobCount = 5;
+
+struct Request {
+    std::uint32_t magic = kMagic;
+    std::int32_t job = 0;
+    std::int64_t dims[3] = {0, 0, 0};
+    double h = 0.0;
+};
+
+enum class Status : std::int32_t { Ok = 0, BadRequest = 1, ShuttingDown = 2 };
+
+struct Reply {
+    std::int32_t status = 0;
+    std::int32_t backend = 0;      // dispatch::Backend the job ran on
+    std::int64_t bytes = 0;        // payload that follows
+    double serverSeconds = 0.0;    // from fully received to reply written
+    std::int32_t batch = 1;        // jobs run in the same call
+    std::int32_t reserved = 0;
+};
+
+inline const char* to_string(Job j) {
+    switch (j) {
+        case Job::Sum: return "sum";
+        case Job::Stencil: return "stencil";
+        case Job::Matmul: return "matmul";
+        case Job::Stats: return "stats";
+        case Job::Shutdown: return "shutdown";
+    }
+    return "?";
+}
+
+inline bool parse_job(const std::string& s, Job& out) {
+    for (int j = 0; j < kJobCount; ++j) {
+        if (s == to_string(static_cast<Job>(j))) {
+            out = static_cast<Job>(j);
+            return true;
+        }
+    }
+    return false;
+}
+
+// The socket lives in /tmp unless SERVICE_SOCKET points elsewhere.
+inline std::string socket_path() {
+    const char* env = std::getenv("SERVICE_SOCKET");
+    return env ? env : kDefaultSocketPath;
+}
+
+// Input bytes that follow `r`, or -1 if the header is malformed.
+inline std::int64_t request_bytes(const Request& r) {
+    if (r.magic != kMagic || r.job < 0 || r.job >= kJobCount) return -1;
+    const std::int64_t* d = r.dims;
+    std::int64_t bytes = 0;
+    switch (static_cast<Job>(r.job)) {
+        case Job::Sum:
+            if (d[0] <= 0 || d[0] > kMaxPayloadBytes) return -1;
+            bytes = d[0] * static_cast<std::int64_t>(sizeof(int));
+            break;
+        case Job::Stencil:
+            if (d[0] <= 0 || d[1] < 3 || d[0] > kMaxPayloadBytes / d[1]) return -1;
+            bytes = d[0] * d[1] * static_cast<std::int64_t>(sizeof(double));
+            break;
+        case Job::Matmul:
+            if (d[0] <= 0 || d[1] <= 0 || d[2] <= 0 || d[0] > 65536 || d[1] > 65536 || d[2] > 65536) return -1;
+            bytes = (d[0] * d[2] + d[2] * d[1]) * static_cast<std::int64_t>(sizeof(double));
+            break;
+        case Job::Stats:
+        case Job::Shutdown:
+            return 0;
+    }
+    return bytes > kMaxPayloadBytes ? -1 : bytes;
+}
+
+// Output bytes the server sends back for a successful `r`.
+inline std::int64_t reply_bytes(const Request& r) {
+    switch (static_cast<Job>(r.job)) {
+        case Job::Sum: return sizeof(long long);
+        case Job::Stencil: return r.dims[0] * r.dims[1] * static_cast<std::int64_t>(sizeof(double));
+        case Job::Matmul: return r.dims[0] * r.dims[1] * static_cast<std::int64_t>(sizeof(double));
+        default: return 0;
+    }
+}
+
+// --- Socket helpers ---------------------------------------------------------
+
+// Blocking full write; waits on POLLOUT if the socket is non-blocking.
+inline bool write_all(int fd, const void* buf, std::size_t n) {
+    const char* p = static_cast<const char*>(buf);
+    while (n > 0) {
+        ssize_t w = ::send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pollfd pfd{fd, POLLOUT, 0};
+                ::poll(&pfd, 1, -1);
+                continue;
+            }
+            return false;
+        }
+        p += w;
+        n -= static_cast<std::size_t>(w);
+    }
+    return true;
+}
+
+inline bool read_all(int fd, void* buf, std::size_t n) {
+    char* p = static_cast<char*>(buf);
+    while (n > 0) {
+        ssize_t r = ::read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        n -= static_cast<std::size_t>(r);
+    }
+    return true;
+}
+
+inline bool fill_address(const std::string& path, sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return false;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// --- Latency percentiles ----------------------------------------------------
+
+// Per-request latencies in seconds; percentiles by nearest rank.
+class Latencies {
+public:
+    void add(double seconds) { samples_.push_back(seconds); }
+    std::size_t count() const { return samples_.size(); }
+    void clear() { samples_.clear(); }
+    void merge(const Latencies& o) { samples_.insert(samples_.end(), o.samples_.begin(), o.samples_.end()); }
+
+    double percentile(double p) {
+        if (samples_.empty()) return 0.0;
+        std::sort(samples_.begin(), samples_.end());
+        std::size_t i = static_cast<std::size_t>(p / 100.0 * samples_.size());
+        return samples_[std::min(i, samples_.size() - 1)];
+    }
+
+    // "n=... p50=...us p90=...us p99=...us max=...us"
+    std::string summary() {
+        char line[160];
+        std::snprintf(line, sizeof(line), "n=%zu p50=%.1fus p90=%.1fus p99=%.1fus max=%.1fus",
+                      count(), percentile(50) * 1e6, percentile(90) * 1e6,
+                      percentile(99) * 1e6, percentile(100) * 1e6);
+        return line;
+    }
+
+private:
+    std::vector<double> samples_;
+};
+
+inline double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// --- Client -----------------------------------------------------------------
+
+// One connection to the server; calls block until the reply is in. Not
+// thread-safe: use one Client per thread.
+class Client {
+public:
+    explicit Client(const std::string& path = socket_path()) {
+        sockaddr_un addr;
+        if (!fill_address(path, addr)) return;
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd_ < 0) return;
+        if (::connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+    ~Client() {
+        if (fd_ >= 0) ::close(fd_);
+    }
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    bool ok() const { return fd_ >= 0; }
+    const Reply& last() const { return reply_; }
+
+    bool sum(const int* data, long n, long long& out) {
+        Request r;
+        r.job = static_cast<std::int32_t>(Job::Sum);
+        r.dims[0] = n;
+        const Part in[] = {{data, n * sizeof(int)}};
+        return call(r, in, 1, &out, sizeof(out));
+    }
+
+    // Order-2 x-derivative of a row-major rows x cols grid.
+    bool stencil(const double* in, double* out, int rows, int cols, double h) {
+        Request r;
+        r.job = static_cast<std::int32_t>(Job::Stencil);
+        r.dims[0] = rows;
+        r.dims[1] = cols;
+        r.h = h;
+        const Part parts[] = {{in, std::size_t(rows) * cols * sizeof(double)}};
+        return call(r, parts, 1, out, std::size_t(rows) * cols * sizeof(double));
+    }
+
+    // C (m x n) = A (m x k) * B (k x n).
+    bool matmul(const double* A, const double* B, double* C, int m, int n, int k) {
+        Request r;
+        r.job = static_cast<std::int32_t>(Job::Matmul);
+        r.dims[0] = m;
+        r.dims[1] = n;
+        r.dims[2] = k;
+        const Part parts[] = {{A, std::size_t(m) * k * sizeof(double)},
+                              {B, std::size_t(k) * n * sizeof(double)}};
+        return call(r, parts, 2, C, std::size_t(m) * n * sizeof(double));
+    }
+
+    bool stats(std::string& text) {
+        Request r;
+        r.job = static_cast<std::int32_t>(Job::Stats);
+        if (!call(r, nullptr, 0, nullptr, 0)) return false;
+        text = extra_;
+        return true;
+    }
+
+    bool shutdown() {
+        Request r;
+        r.job = static_cast<std::int32_t>(Job::Shutdown);
+        return call(r, nullptr, 0, nullptr, 0);
+    }
+
+private:
+    struct Part {
+        const void* data;
+        std::size_t bytes;
+    };
+
+    // Replies larger than `outBytes` (the stats text) land in extra_.
+    bool call(const Request& r, const Part* parts, int nparts, void* out, std::size_t outBytes) {
+        if (fd_ < 0 || !write_all(fd_, &r, sizeof(r))) return false;
+        for (int i = 0; i < nparts; ++i) {
+            if (!write_all(fd_, parts[i].data, parts[i].bytes)) return false;
+        }
+        if (!read_all(fd_, &reply_, sizeof(reply_))) return false;
+        if (reply_.bytes < 0 || reply_.bytes > kMaxPayloadBytes) return false;
+        std::size_t got = static_cast<std::size_t>(reply_.bytes);
+        if (out && got == outBytes) return read_all(fd_, out, got) && reply_.status == 0;
+        extra_.resize(got);
+        return (got == 0 || read_all(fd_, &extra_[0], got)) && reply_.status == 0;
+    }
+
+    int fd_ = -1;
+    Reply reply_;
+    std::string extra_;
+};
+
+} // namespace service
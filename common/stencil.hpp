@@ -0,0 +1,356 @@
+#pragma once
+
+// Central finite-difference first derivatives on row-major grids, with the
+// accuracy order (2/4/6/8), axis and boundary policy fixed at compile time.
+//
+//   stencil::derivative<4, stencil::Axis::X>(in, out, rows, cols, hx, hy, r0, r1);
+//
+// The interior of every row is a branch-free loop over a compile-time
+// stencil, so the compiler can unroll and vectorise it; the few points
+// within `Order / 2` of an edge are peeled into separate boundary loops.
+// opencl_source<>() emits an equivalent OpenCL kernel from the same tables.
+//
+// Axis::X differentiates along a row (column index), Axis::Y across rows and
+// Axis::XY gives the mixed derivative d2f/dxdy.
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#if defined(_OPENMP)
+#define STENCIL_SIMD _Pragma("omp simd")
+#elif defined(__GNUC__) && !defined(__clang__)
+#define STENCIL_SIMD _Pragma("GCC ivdep")
+#else
+#define STENCIL_SIMD
+#endif
+
+namespace stencil {
+
+constexpr int kMaxRadius = 4;
+
+// kCentral[r - 1][k - 1]: weight of f[i + k] - f[i - k] in the central first
+// derivative of radius r (accuracy order 2r).
+inline constexpr double kCentral[kMaxRadius][kMaxRadius] = {
+    {1.0 / 2.0,  0.0,         0.0,          0.0},
+    {2.0 / 3.0,  -1.0 / 12.0, 0.0,          0.0},
+    {3.0 / 4.0,  -3.0 / 20.0, 1.0 / 60.0,   0.0},
+    {4.0 / 5.0,  -1.0 / 5.0,  4.0 / 105.0,  -1.0 / 280.0},
+};
+
+enum class Axis { X, Y, XY };
+
+// Stencil weights for one boundary point: out = sum coef[t] * f[idx[t]].
+struct Weights {
+    int count = 0;
+    int idx[2 * kMaxRadius];
+    double coef[2 * kMaxRadius];
+
+    void add(int i, double c) {
+        idx[count] = i;
+        coef[count] = c;
+        ++count;
+    }
+};
+
+inline void add_central(Weights& w, int p, int r) {
+    for (int k = 1; k <= r; ++k) {
+        w.add(p + k, kCentral[r - 1][k - 1]);
+        w.add(p - k, -kCentral[r - 1][k - 1]);
+    }
+}
+
+// --- Boundary policies ------------------------------------------------------
+//
+// weights<R>(p, n): stencil for position p on a line of n points when the
+// full radius-R stencil would leave the line. kOpenCL is the same rule for
+// the generated kernels (STENCIL_R and kCentral are defined there).
+
+// Drops to the widest central stencil that fits, and to a first-order
+// one-sided difference on the edge itself. At order 2 this is exactly the
+// scheme the tasks used before.
+struct Shrink {
+    template <int R>
+    static Weights weights(int p, int n) {
+        Weights w;
+        if (n < 2) return w;
+        int r = std::min(R, std::min(p, n - 1 - p));
+        if (r == 0) {
+            bool left = p == 0;
+            w.add(left ? 1 : n - 1, 1.0);
+            w.add(left ? 0 : n - 2, -1.0);
+        } else {
+            add_central(w, p, r);
+        }
+        return w;
+    }
+
+    static constexpr const char* kOpenCL = R"CLC(
+int boundary_weights(int p, int n, int* idx, double* coef) {
+    if (n < 2) return 0;
+    int r = min(STENCIL_R, min(p, n - 1 - p));
+    if (r == 0) {
+        idx[0] = p == 0 ? 1 : n - 1; coef[0] = 1.0;
+        idx[1] = p == 0 ? 0 : n - 2; coef[1] = -1.0;
+        return 2;
+    }
+    int c = 0;
+    for (int k = 1; k <= r; ++k) {
+        idx[c] = p + k; coef[c++] = kCentral[r - 1][k - 1];
+        idx[c] = p - k; coef[c++] = -kCentral[r - 1][k - 1];
+    }
+    return c;
+}
+)CLC";
+};
+
+// Replicates the edge value outside the grid.
+struct Clamp {
+    template <int R>
+    static Weights weights(int p, int n) {
+        Weights w;
+        for (int k = 1; k <= R; ++k) {
+            w.add(std::min(p + k, n - 1), kCentral[R - 1][k - 1]);
+            w.add(std::max(p - k, 0), -kCentral[R - 1][k - 1]);
+        }
+        return w;
+    }
+
+    static constexpr const char* kOpenCL = R"CLC(
+int boundary_weights(int p, int n, int* idx, double* coef) {
+    int c = 0;
+    for (int k = 1; k <= STENCIL_R; ++k) {
+        idx[c] = min(p + k, n - 1); coef[c++] = kCentral[STENCIL_R - 1][k - 1];
+        idx[c] = max(p - k, 0);     coef[c++] = -kCentral[STENCIL_R - 1][k - 1];
+    }
+    return c;
+}
+)CLC";
+};
+
+// Wraps around: the grid is one period of a periodic function.
+struct Periodic {
+    template <int R>
+    static Weights weights(int p, int n) {
+        Weights w;
+        for (int k = 1; k <= R; ++k) {
+            w.add(((p + k) % n + n) % n, kCentral[R - 1][k - 1]);
+            w.add(((p - k) % n + n) % n, -kCentral[R - 1][k - 1]);
+        }
+        return w;
+    }
+
+    static constexpr const char* kOpenCL = R"CLC(
+int boundary_weights(int p, int n, int* idx, double* coef) {
+    int c = 0;
+    for (int k = 1; k <= STENCIL_R; ++k) {
+        idx[c] = ((p + k) % n + n) % n; coef[c++] = kCentral[STENCIL_R - 1][k - 1];
+        idx[c] = ((p - k) % n + n) % n; coef[c++] = -kCentral[STENCIL_R - 1][k - 1];
+    }
+    return c;
+}
+)CLC";
+};
+
+// --- Kernels ----------------------------------------------------------------
+
+namespace detail {
+
+template <int R>
+inline double central(const double* f, long stride) {
+    double acc = 0.0;
+    for (int k = 1; k <= R; ++k) {
+        acc += kCentral[R - 1][k - 1] * (f[k * stride] - f[-k * stride]);
+    }
+    return acc;
+}
+
+inline double apply_weights(const Weights& w, const double* line, long stride) {
+    double acc = 0.0;
+    for (int t = 0; t < w.count; ++t) {
+        acc += w.coef[t] * line[w.idx[t] * stride];
+    }
+    return acc;
+}
+
+// Columns [0, lo) and [hi, cols) are boundary points in x.
+template <int R>
+inline void split_line(int n, int& lo, int& hi) {
+    lo = std::min(R, n);
+    hi = std::max(n - R, lo);
+}
+
+template <int R, class Boundary>
+void row_x(const double* row, double* dst, int cols, double invH) {
+    int lo, hi;
+    split_line<R>(cols, lo, hi);
+    for (int j = 0; j < lo; ++j) {
+        dst[j] = apply_weights(Boundary::template weights<R>(j, cols), row, 1) * invH;
+    }
+    STENCIL_SIMD
+    for (int j = lo; j < hi; ++j) {
+        dst[j] = central<R>(row + j, 1) * invH;
+    }
+    for (int j = hi; j < cols; ++j) {
+        dst[j] = apply_weights(Boundary::template weights<R>(j, cols), row, 1) * invH;
+    }
+}
+
+template <int R, class Boundary>
+void row_y(const double* in, double* dst, int i, int rows, int cols, double invH) {
+    const double* col0 = in + static_cast<long>(i) * cols;
+    if (i >= R && i < rows - R) {
+        STENCIL_SIMD
+        for (int j = 0; j < cols; ++j) {
+            dst[j] = central<R>(col0 + j, cols) * invH;
+        }
+        return;
+    }
+    const Weights w = Boundary::template weights<R>(i, rows);
+    for (int j = 0; j < cols; ++j) {
+        dst[j] = apply_weights(w, in + j, cols) * invH;
+    }
+}
+
+// Mixed derivative at a point where either direction needs boundary weights.
+template <int R, class Boundary>
+double point_xy(const double* in, int i, int j, int rows, int cols) {
+    Weights wy, wx;
+    if (i >= R && i < rows - R) add_central(wy, i, R); else wy = Boundary::template weights<R>(i, rows);
+    if (j >= R && j < cols - R) add_central(wx, j, R); else wx = Boundary::template weights<R>(j, cols);
+    double acc = 0.0;
+    for (int a = 0; a < wy.count; ++a) {
+        acc += wy.coef[a] * apply_weights(wx, in + static_cast<long>(wy.idx[a]) * cols, 1);
+    }
+    return acc;
+}
+
+template <int R, class Boundary>
+void row_xy(const double* in, double* dst, int i, int rows, int cols, double invH) {
+    int lo, hi;
+    split_line<R>(cols, lo, hi);
+    bool interiorRow = i >= R && i < rows - R;
+    if (!interiorRow) {
+        lo = hi = cols;
+    }
+    for (int j = 0; j < std::min(lo, cols); ++j) {
+        dst[j] = point_xy<R, Boundary>(in, i, j, rows, cols) * invH;
+    }
+    const double* c = in + static_cast<long>(i) * cols;
+    STENCIL_SIMD
+    for (int j = lo; j < hi; ++j) {
+        double acc = 0.0;
+        for (int a = 1; a <= R; ++a) {
+            acc += kCentral[R - 1][a - 1] * (central<R>(c + j + a * cols, 1) - central<R>(c + j - a * cols, 1));
+        }
+        dst[j] = acc * invH;
+    }
+    for (int j = interiorRow ? hi : cols; j < cols; ++j) {
+        dst[j] = point_xy<R, Boundary>(in, i, j, rows, cols) * invH;
+    }
+}
+
+} // namespace detail
+
+// Derivative of rows [rowBegin, rowEnd) of a rows x cols grid. Axis::Y and
+// Axis::XY read up to Order / 2 neighbouring rows on each side.
+template <int Order, Axis A, class Boundary = Shrink>
+void derivative(const double* in, double* out, int rows, int cols,
+                double hx, double hy, int rowBegin, int rowEnd) {
+    static_assert(Order == 2 || Order == 4 || Order == 6 || Order == 8,
+                  "supported orders are 2, 4, 6 and 8");
+    constexpr int R = Order / 2;
+    for (int i = rowBegin; i < rowEnd; ++i) {
+        double* dst = out + static_cast<long>(i) * cols;
+        if constexpr (A == Axis::X) {
+            detail::row_x<R, Boundary>(in + static_cast<long>(i) * cols, dst, cols, 1.0 / hx);
+        } else if constexpr (A == Axis::Y) {
+            detail::row_y<R, Boundary>(in, dst, i, rows, cols, 1.0 / hy);
+        } else {
+            detail::row_xy<R, Boundary>(in, dst, i, rows, cols, 1.0 / (hx * hy));
+        }
+    }
+}
+
+// --- OpenCL -----------------------------------------------------------------
+
+namespace detail {
+
+// Unrolled interior expression, e.g. "(0.5 * (in[i + 1] - in[i - 1]))",
+// with `step` the index distance between neighbours.
+inline std::string central_expr(int R, const std::string& at, const std::string& step) {
+    std::ostringstream s;
+    s.precision(17);
+    s << "(";
+    for (int k = 1; k <= R; ++k) {
+        if (k > 1) s << " + ";
+        s << kCentral[R - 1][k - 1] << " * (in[" << at << " + " << k << " * " << step << "] - in["
+          << at << " - " << k << " * " << step << "])";
+    }
+    s << ")";
+    return s.str();
+}
+
+} // namespace detail
+
+// Kernel `name(in, out, rows, cols, hx, hy)` over a 2D range (cols, rows),
+// one work-item per grid point.
+template <int Order, Axis A, class Boundary = Shrink>
+std::string opencl_source(const std::string& name) {
+    static_assert(Order == 2 || Order == 4 || Order == 6 || Order == 8,
+                  "supported orders are 2, 4, 6 and 8");
+    constexpr int R = Order / 2;
+    std::ostringstream s;
+    s.precision(17);
+    s << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n"
+      << "#define STENCIL_R " << R << "\n"
+      << "__constant double kCentral[" << kMaxRadius << "][" << kMaxRadius << "] = {\n";
+    for (int r = 0; r < kMaxRadius; ++r) {
+        s << "    {";
+        for (int k = 0; k < kMaxRadius; ++k) s << (k ? ", " : "") << kCentral[r][k];
+        s << "},\n";
+    }
+    s << "};\n" << Boundary::kOpenCL;
+
+    s << "__kernel void " << name << "(__global const double* in, __global double* out,\n"
+      << "        const int rows, const int cols, const double hx, const double hy) {\n"
+      << "    const int j = get_global_id(0);\n"
+      << "    const int i = get_global_id(1);\n"
+      << "    if (i >= rows || j >= cols) return;\n"
+      << "    const int p = i * cols + j;\n"
+      << "    const bool inX = j >= STENCIL_R && j < cols - STENCIL_R;\n"
+      << "    const bool inY = i >= STENCIL_R && i < rows - STENCIL_R;\n"
+      << "    int ix[" << 2 * kMaxRadius << "], iy[" << 2 * kMaxRadius << "];\n"
+      << "    double cx[" << 2 * kMaxRadius << "], cy[" << 2 * kMaxRadius << "];\n"
+      << "    double acc = 0.0;\n";
+
+    if (A == Axis::X) {
+        s << "    if (inX) { out[p] = " << detail::central_expr(R, "p", "1") << " / hx; return; }\n"
+          << "    int n = boundary_weights(j, cols, ix, cx);\n"
+          << "    for (int t = 0; t < n; ++t) acc += cx[t] * in[i * cols + ix[t]];\n"
+          << "    out[p] = acc / hx;\n";
+    } else if (A == Axis::Y) {
+        s << "    if (inY) { out[p] = " << detail::central_expr(R, "p", "cols") << " / hy; return; }\n"
+          << "    int n = boundary_weights(i, rows, iy, cy);\n"
+          << "    for (int t = 0; t < n; ++t) acc += cy[t] * in[iy[t] * cols + j];\n"
+          << "    out[p] = acc / hy;\n";
+    } else {
+        s << "    if (inX && inY) {\n";
+        for (int a = 1; a <= R; ++a) {
+            s << "        acc += " << kCentral[R - 1][a - 1] << " * ("
+              << detail::central_expr(R, "(p + " + std::to_string(a) + " * cols)", "1") << " - "
+              << detail::central_expr(R, "(p - " + std::to_string(a) + " * cols)", "1") << ");\n";
+        }
+        s << "        out[p] = acc / (hx * hy); return;\n"
+          << "    }\n"
+          << "    int ny = boundary_weights(i, rows, iy, cy);\n"
+          << "    int nx = boundary_weights(j, cols, ix, cx);\n"
+          << "    for (int a = 0; a < ny; ++a)\n"
+          << "        for (int b = 0; b < nx; ++b) acc += cy[a] * cx[b] * in[iy[a] * cols + ix[b]];\n"
+          << "    out[p] = acc / (hx * hy);\n";
+    }
+    s << "}\n";
+    return s.str();
+}
+
+} // namespace stencil
@@ -0,0 +1,298 @@
+#pragma once
+
+// Timeline tracing, written as Chrome trace events: open the file in
+// ui.perfetto.dev or chrome://tracing to see every rank and thread on one
+// time axis.
+//
+// Disabled unless TRACE=<path>. Each thread then records into its own ring
+// of TRACE_EVENTS (default 65536) fixed-size events. A span costs two clock
+// reads and one store; no lock is taken after the thread's first event.
+// When a ring is full its oldest events are overwritten and counted as
+// dropped.
+//
+// Where the events come from:
+//   - Span, an RAII region. The OpenMP kernels open one on the master
+//     around the parallel region and one on every thread around its chunk.
+//   - trace_mpi.hpp, which wraps the MPI calls through the PMPI profiling
+//     interface. It also aligns the rank clocks and merges all ranks into
+//     one file at MPI_Finalize.
+//   - trace_opencl.hpp, whose device() records a finished OpenCL command
+//     from its profiling timestamps on a separate "device" track, shifted
+//     onto the host clock.
+//
+// Programs without MPI write the file when they exit.
+//
+// Names, categories and argument keys are stored by pointer, so they must
+// be string literals (or otherwise outlive the program).
+
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace trace {
+
+constexpr std::size_t kDefaultEvents = 1 << 16;
+constexpr int kDeviceTid = 1000;   // track of the OpenCL device commands
+
+inline std::int64_t now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<std::int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
+
+struct Event {
+    const char* name;
+    const char* cat;
+    const char* arg;       // key of value, or nullptr
+    std::int64_t begin;    // ns; device clock when onDevice
+    std::int64_t end;
+    std::int64_t value;
+    int peer;              // MPI rank at the other end, or -1
+    bool onDevice;
+};
+
+// Single-writer ring: only the owning thread pushes. It is read once the
+// threads are idle, when the trace is written.
+class Ring {
+public:
+    Ring(int tid, int sortIndex, std::string name, std::size_t capacity)
+        : events_(capacity), tid_(tid), sortIndex_(sortIndex), name_(std::move(name)) {}
+
+    void push(const Event& e) {
+        events_[count_ % events_.size()] = e;
+        ++count_;
+    }
+
+    // Oldest event first.
+    template <typename F>
+    void for_each(F f) const {
+        const std::size_t kept = std::min(count_, events_.size());
+        for (std::size_t i = count_ - kept; i < count_; ++i) f(events_[i % events_.size()]);
+    }
+
+    std::size_t dropped() const { return count_ > events_.size() ? count_ - events_.size() : 0; }
+    int tid() const { return tid_; }
+    int sort_index() const { return sortIndex_; }
+    const std::string& name() const { return name_; }
+
+private:
+    std::vector<Event> events_;
+    std::size_t count_ = 0;
+    int tid_;
+    int sortIndex_;
+    std::string name_;
+};
+
+inline void write_at_exit();
+
+struct State {
+    State() {
+        const char* env = std::getenv("TRACE");
+        path = env ? env : "";
+        const char* events = std::getenv("TRACE_EVENTS");
+        capacity = events ? std::max(1L, std::atol(events)) : kDefaultEvents;
+        if (!path.empty()) std::atexit(write_at_exit);
+    }
+
+    std::string path;
+    std::size_t capacity;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+    // Smallest (host time after completion - device end) seen: adding it
+    // to a device timestamp gives a host time no later than the real one.
+    std::int64_t deviceOffset = std::numeric_limits<std::int64_t>::max();
+    std::int64_t origin = now();
+    bool merged = false;   // set by trace_mpi.hpp, which writes the file itself
+};
+
+// Never destroyed, so threads and atexit handlers can still record.
+inline State& state() {
+    static State* s = new State();
+    return *s;
+}
+
+inline bool enabled() {
+    static const bool on = !state().path.empty();
+    return on;
+}
+
+inline thread_local Ring* tlsRing = nullptr;
+
+inline Ring& ring() {
+    if (tlsRing) return *tlsRing;
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    const int tid = static_cast<int>(s.rings.size());
+    std::string name = tid == 0 ? "main" : "thread " + std::to_string(tid);
+    int sortIndex = tid;
+#ifdef _OPENMP
+    // OpenMP workers are listed in thread-number order, after the master.
+    if (omp_in_parallel() && omp_get_thread_num() > 0) {
+        name = "omp thread " + std::to_string(omp_get_thread_num());
+        sortIndex = omp_get_thread_num();
+    }
+#endif
+    s.rings.push_back(std::make_unique<Ring>(tid, sortIndex, std::move(name), s.capacity));
+    tlsRing = s.rings.back().get();
+    return *tlsRing;
+}
+
+inline void record(const char* name, const char* cat, std::int64_t begin, std::int64_t end,
+                   const char* arg = nullptr, std::int64_t value = 0, int peer = -1,
+                   bool onDevice = false) {
+    ring().push(Event{name, cat, arg, begin, end, value, peer, onDevice});
+}
+
+// Records the enclosing scope on the calling thread's track.
+class Span {
+public:
+    Span(const char* name, const char* cat, const char* arg = nullptr, std::int64_t value = 0)
+        : name_(name), cat_(cat), arg_(arg), value_(value) {
+        if (enabled()) {
+            ring();   // register on entry, so the master of a region is track 0
+            begin_ = now();
+        }
+    }
+    ~Span() {
+        if (begin_) record(name_, cat_, begin_, now(), arg_, value_);
+    }
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    const char* name_;
+    const char* cat_;
+    const char* arg_;
+    std::int64_t value_;
+    std::int64_t begin_ = 0;
+};
+
+// Maps a host timestamp onto the trace timeline, in microseconds. The
+// offset of this clock against the reference clock is linear in local time
+// between two samples (trace_mpi.hpp); a single process uses its own clock.
+struct Timeline {
+    std::int64_t origin = 0;   // trace zero, on the reference clock
+    std::int64_t at = 0;       // local time of the first offset sample
+    double offset = 0.0;       // local minus reference clock at `at`
+    double drift = 0.0;        // change of that offset per local ns
+
+    double micros(std::int64_t t) const {
+        return (t - offset - drift * static_cast<double>(t - at) - origin) / 1000.0;
+    }
+};
+
+struct Fragment {
+    std::string json;   // comma-separated events, no enclosing brackets
+    long events = 0;
+    long dropped = 0;
+};
+
+inline void append(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+inline void append(std::string& out, const char* fmt, ...) {
+    char buf[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = std::vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (!out.empty()) out += ",\n";
+    out.append(buf, std::min<std::size_t>(n, sizeof(buf) - 1));
+}
+
+inline void append_thread_name(std::string& out, int pid, int tid, int sortIndex,
+                               const std::string& name) {
+    append(out, R"({"name":"thread_name","ph":"M","pid":%d,"tid":%d,"args":{"name":"%s"}})",
+           pid, tid, name.c_str());
+    append(out, R"({"name":"thread_sort_index","ph":"M","pid":%d,"tid":%d,"args":{"sort_index":%d}})",
+           pid, tid, sortIndex);
+}
+
+// This process's events, as one "pid" of the trace.
+inline Fragment serialize(int pid, const std::string& processName, const Timeline& clock) {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    Fragment f;
+    append(f.json, R"({"name":"process_name","ph":"M","pid":%d,"args":{"name":"%s"}})",
+           pid, processName.c_str());
+    append(f.json, R"({"name":"process_sort_index","ph":"M","pid":%d,"args":{"sort_index":%d}})",
+           pid, pid);
+
+    bool device = false;
+    for (const auto& r : s.rings) {
+        append_thread_name(f.json, pid, r->tid(), r->sort_index(), r->name());
+        f.dropped += static_cast<long>(r->dropped());
+        r->for_each([&](const Event& e) {
+            std::int64_t shift = 0;
+            if (e.onDevice) {
+                device = true;
+                shift = s.deviceOffset;
+            }
+            const double ts = clock.micros(e.begin + shift);
+            const double dur = std::max(0.0, clock.micros(e.end + shift) - ts);
+            char args[96] = "";
+            if (e.arg && e.peer >= 0) {
+                std::snprintf(args, sizeof(args), R"(,"args":{"%s":%lld,"peer":%d})", e.arg,
+                              static_cast<long long>(e.value), e.peer);
+            } else if (e.arg) {
+                std::snprintf(args, sizeof(args), R"(,"args":{"%s":%lld})", e.arg,
+                              static_cast<long long>(e.value));
+            } else if (e.peer >= 0) {
+                std::snprintf(args, sizeof(args), R"(,"args":{"peer":%d})", e.peer);
+            }
+            append(f.json, R"({"name":"%s","cat":"%s","ph":"X","pid":%d,"tid":%d,"ts":%.3f,"dur":%.3f%s})",
+                   e.name, e.cat, pid, e.onDevice ? kDeviceTid : r->tid(), ts, dur, args);
+            ++f.events;
+        });
+    }
+    if (device) append_thread_name(f.json, pid, kDeviceTid, kDeviceTid, "OpenCL device");
+    return f;
+}
+
+inline bool write_file(const std::string& path, const std::vector<std::string>& fragments) {
+    std::FILE* out = std::fopen(path.c_str(), "w");
+    if (!out) {
+        std::fprintf(stderr, "[trace] cannot write %s\n", path.c_str());
+        return false;
+    }
+    std::fputs("{\"traceEvents\":[\n", out);
+    bool first = true;
+    for (const auto& part : fragments) {
+        if (part.empty()) continue;
+        if (!first) std::fputs(",\n", out);
+        std::fwrite(part.data(), 1, part.size(), out);
+        first = false;
+    }
+    std::fputs("\n],\"displayTimeUnit\":\"ns\"}\n", out);
+    std::fclose(out);
+    return true;
+}
+
+inline void print_written(const std::string& path, long events, long dropped, int processes) {
+    std::printf("[trace] %ld events from %d process%s (%ld dropped) written to %s\n", events,
+                processes, processes == 1 ? "" : "es", dropped, path.c_str());
+}
+
+inline void write_at_exit() {
+    State& s = state();
+    if (s.merged || s.rings.empty()) return;
+    s.merged = true;
+    Timeline clock;
+    clock.origin = s.origin;
+    Fragment f = serialize(0, "pid " + std::to_string(getpid()), clock);
+    if (write_file(s.path, {f.json})) print_written(s.path, f.events, f.dropped, 1);
+}
+
+} // namespace trace
@@ -0,0 +1,304 @@
+#pragma once
+
+// MPI side of trace.hpp. Include it from exactly one translation unit of an
+// MPI program: it defines MPI_* wrappers that the linker picks over the
+// library's, and each one calls its PMPI_* twin. With TRACE unset a wrapper
+// costs one branch.
+//
+// Recorded calls (category "mpi", args bytes and peer where they apply):
+//   point to point  Send, Recv, Isend, Irecv
+//   completion      Wait, Waitall, Waitany
+//   collectives     Barrier, Bcast, Ibcast, Scatter, Scatterv, Gather,
+//                   Gatherv, Allgather, Reduce, Allreduce
+// MPI_Test is not wrapped: the dispatcher polls it in a loop and every poll
+// would become an event.
+//
+// Clock alignment: MPI_Init and MPI_Finalize each measure every rank's
+// offset against rank 0 with ping-pongs, keeping the round with the
+// smallest round trip (Cristian's method). Timestamps are then corrected
+// with the offset interpolated linearly between the two samples, which
+// also removes the drift over the run. At MPI_Finalize every rank
+// serialises its events and rank 0 gathers and writes the one file; each
+// rank is one "process" of the trace.
+
+#include <mpi.h>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "trace.hpp"
+
+namespace trace {
+namespace mpi {
+
+constexpr int kSyncRounds = 16;
+constexpr int kSyncTag = 32767;   // the smallest MPI_TAG_UB an MPI must allow
+
+// Local time `at` and the local clock minus rank 0's clock at that time.
+struct Sample {
+    std::int64_t at = 0;
+    std::int64_t offset = 0;
+};
+
+struct Clocks {
+    MPI_Comm comm = MPI_COMM_NULL;   // private duplicate of MPI_COMM_WORLD
+    Sample first;
+    std::int64_t origin = 0;         // rank 0's clock at MPI_Init
+};
+
+inline Clocks& clocks() {
+    static Clocks c;
+    return c;
+}
+
+inline Sample measure_offset(MPI_Comm comm) {
+    int rank = 0, size = 1;
+    PMPI_Comm_rank(comm, &rank);
+    PMPI_Comm_size(comm, &size);
+    Sample mine;
+    mine.at = now();
+    for (int peer = 1; peer < size; ++peer) {
+        if (rank == 0) {
+            std::int64_t bestRtt = std::numeric_limits<std::int64_t>::max();
+            std::int64_t best[2] = {0, 0};   // offset, round
+            for (int round = 0; round < kSyncRounds; ++round) {
+                std::int64_t t0 = now(), remote = 0;
+                PMPI_Send(&t0, 1, MPI_INT64_T, peer, kSyncTag, comm);
+                PMPI_Recv(&remote, 1, MPI_INT64_T, peer, kSyncTag, comm, MPI_STATUS_IGNORE);
+                std::int64_t t1 = now();
+                if (t1 - t0 < bestRtt) {
+                    bestRtt = t1 - t0;
+                    best[0] = remote - (t0 + (t1 - t0) / 2);
+                    best[1] = round;
+                }
+            }
+            PMPI_Send(best, 2, MPI_INT64_T, peer, kSyncTag, comm);
+        } else if (rank == peer) {
+            std::int64_t stamps[kSyncRounds], best[2];
+            for (int round = 0; round < kSyncRounds; ++round) {
+                std::int64_t ping = 0;
+                PMPI_Recv(&ping, 1, MPI_INT64_T, 0, kSyncTag, comm, MPI_STATUS_IGNORE);
+                stamps[round] = now();
+                PMPI_Send(&stamps[round], 1, MPI_INT64_T, 0, kSyncTag, comm);
+            }
+            PMPI_Recv(best, 2, MPI_INT64_T, 0, kSyncTag, comm, MPI_STATUS_IGNORE);
+            mine.offset = best[0];
+            mine.at = stamps[best[1]];
+        }
+    }
+    return mine;
+}
+
+inline void start() {
+    Clocks& c = clocks();
+    PMPI_Comm_dup(MPI_COMM_WORLD, &c.comm);
+    c.first = measure_offset(c.comm);
+    c.origin = c.first.at - c.first.offset;
+    PMPI_Bcast(&c.origin, 1, MPI_INT64_T, 0, c.comm);
+}
+
+// Writes the merged trace; collective over MPI_COMM_WORLD.
+inline void merge() {
+    Clocks& c = clocks();
+    const Sample last = measure_offset(c.comm);
+    int rank = 0, size = 1;
+    PMPI_Comm_rank(c.comm, &rank);
+    PMPI_Comm_size(c.comm, &size);
+
+    Timeline clock;
+    clock.origin = c.origin;
+    clock.at = c.first.at;
+    clock.offset = static_cast<double>(c.first.offset);
+    if (last.at > c.first.at) {
+        clock.drift = static_cast<double>(last.offset - c.first.offset) / (last.at - c.first.at);
+    }
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    Fragment f = serialize(rank, "rank " + std::to_string(rank) + " (" + host + ")", clock);
+    state().merged = true;
+
+    int length = static_cast<int>(f.json.size());
+    long totals[2] = {f.events, f.dropped}, sums[2] = {0, 0};
+    std::vector<int> lengths(rank == 0 ? size : 0), displs(rank == 0 ? size : 0);
+    PMPI_Gather(&length, 1, MPI_INT, lengths.data(), 1, MPI_INT, 0, c.comm);
+    PMPI_Reduce(totals, sums, 2, MPI_LONG, MPI_SUM, 0, c.comm);
+    std::string all;
+    if (rank == 0) {
+        int offset = 0;
+        for (int r = 0; r < size; ++r) {
+            displs[r] = offset;
+            offset += lengths[r];
+        }
+        all.resize(offset);
+    }
+    PMPI_Gatherv(f.json.data(), length, MPI_CHAR, &all[0], lengths.data(), displs.data(),
+                 MPI_CHAR, 0, c.comm);
+    if (rank == 0) {
+        std::vector<std::string> fragments;
+        for (int r = 0; r < size; ++r) fragments.push_back(all.substr(displs[r], lengths[r]));
+        if (write_file(state().path, fragments)) print_written(state().path, sums[0], sums[1], size);
+    }
+    PMPI_Comm_free(&c.comm);
+}
+
+inline std::int64_t bytes(int count, MPI_Datatype type) {
+    int size = 0;
+    PMPI_Type_size(type, &size);
+    return static_cast<std::int64_t>(count) * size;
+}
+
+} // namespace mpi
+} // namespace trace
+
+// Each wrapper times its PMPI_* call and records it on the calling thread.
+#define TRACE_MPI_CALL(name, call, bytesExpr, peerExpr)                               \
+    do {                                                                              \
+        if (!trace::enabled()) return call;                                           \
+        const std::int64_t t0_ = trace::now();                                        \
+        const int rc_ = call;                                                         \
+        trace::record(name, "mpi", t0_, trace::now(), "bytes", bytesExpr, peerExpr); \
+        return rc_;                                                                   \
+    } while (0)
+
+extern "C" {
+
+int MPI_Init(int* argc, char*** argv) {
+    const int rc = PMPI_Init(argc, argv);
+    if (rc == MPI_SUCCESS && trace::enabled()) trace::mpi::start();
+    return rc;
+}
+
+int MPI_Finalize() {
+    if (trace::enabled()) trace::mpi::merge();
+    return PMPI_Finalize();
+}
+
+int MPI_Send(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm) {
+    TRACE_MPI_CALL("MPI_Send", PMPI_Send(buf, count, type, dest, tag, comm),
+                   trace::mpi::bytes(count, type), dest);
+}
+
+int MPI_Recv(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm,
+             MPI_Status* status) {
+    if (!trace::enabled()) return PMPI_Recv(buf, count, type, source, tag, comm, status);
+    MPI_Status local;
+    if (status == MPI_STATUS_IGNORE) status = &local;
+    const std::int64_t t0 = trace::now();
+    const int rc = PMPI_Recv(buf, count, type, source, tag, comm, status);
+    int received = 0;
+    PMPI_Get_count(status, type, &received);
+    trace::record("MPI_Recv", "mpi", t0, trace::now(), "bytes", trace::mpi::bytes(received, type),
+                  status->MPI_SOURCE);
+    return rc;
+}
+
+int MPI_Isend(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm,
+              MPI_Request* request) {
+    TRACE_MPI_CALL("MPI_Isend", PMPI_Isend(buf, count, type, dest, tag, comm, request),
+                   trace::mpi::bytes(count, type), dest);
+}
+
+int MPI_Irecv(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm,
+              MPI_Request* request) {
+    TRACE_MPI_CALL("MPI_Irecv", PMPI_Irecv(buf, count, type, source, tag, comm, request),
+                   trace::mpi::bytes(count, type), source);
+}
+
+int MPI_Wait(MPI_Request* request, MPI_Status* status) {
+    if (!trace::enabled()) return PMPI_Wait(request, status);
+    const std::int64_t t0 = trace::now();
+    const int rc = PMPI_Wait(request, status);
+    trace::record("MPI_Wait", "mpi", t0, trace::now());
+    return rc;
+}
+
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[]) {
+    if (!trace::enabled()) return PMPI_Waitall(count, requests, statuses);
+    const std::int64_t t0 = trace::now();
+    const int rc = PMPI_Waitall(count, requests, statuses);
+    trace::record("MPI_Waitall", "mpi", t0, trace::now(), "requests", count);
+    return rc;
+}
+
+int MPI_Waitany(int count, MPI_Request requests[], int* index, MPI_Status* status) {
+    if (!trace::enabled()) return PMPI_Waitany(count, requests, index, status);
+    const std::int64_t t0 = trace::now();
+    const int rc = PMPI_Waitany(count, requests, index, status);
+    trace::record("MPI_Waitany", "mpi", t0, trace::now(), "requests", count);
+    return rc;
+}
+
+int MPI_Barrier(MPI_Comm comm) {
+    if (!trace::enabled()) return PMPI_Barrier(comm);
+    const std::int64_t t0 = trace::now();
+    const int rc = PMPI_Barrier(comm);
+    trace::record("MPI_Barrier", "mpi", t0, trace::now());
+    return rc;
+}
+
+int MPI_Bcast(void* buf, int count, MPI_Datatype type, int root, MPI_Comm comm) {
+    TRACE_MPI_CALL("MPI_Bcast", PMPI_Bcast(buf, count, type, root, comm),
+                   trace::mpi::bytes(count, type), root);
+}
+
+int MPI_Ibcast(void* buf, int count, MPI_Datatype type, int root, MPI_Comm comm,
+               MPI_Request* request) {
+    TRACE_MPI_CALL("MPI_Ibcast", PMPI_Ibcast(buf, count, type, root, comm, request),
+                   trace::mpi::bytes(count, type), root);
+}
+
+int MPI_Scatter(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf,
+                int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm) {
+    TRACE_MPI_CALL("MPI_Scatter",
+                   PMPI_Scatter(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm),
+                   trace::mpi::bytes(recvcount, recvtype), root);
+}
+
+int MPI_Scatterv(const void* sendbuf, const int sendcounts[], const int displs[],
+                 MPI_Datatype sendtype, void* recvbuf, int recvcount, MPI_Datatype recvtype,
+                 int root, MPI_Comm comm) {
+    TRACE_MPI_CALL("MPI_Scatterv",
+                   PMPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount,
+                                 recvtype, root, comm),
+                   trace::mpi::bytes(recvcount, recvtype), root);
+}
+
+int MPI_Gather(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf,
+               int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm) {
+    TRACE_MPI_CALL("MPI_Gather",
+                   PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm),
+                   trace::mpi::bytes(sendcount, sendtype), root);
+}
+
+int MPI_Gatherv(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf,
+                const int recvcounts[], const int displs[], MPI_Datatype recvtype, int root,
+                MPI_Comm comm) {
+    TRACE_MPI_CALL("MPI_Gatherv",
+                   PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs,
+                                recvtype, root, comm),
+                   trace::mpi::bytes(sendcount, sendtype), root);
+}
+
+int MPI_Allgather(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf,
+                  int recvcount, MPI_Datatype recvtype, MPI_Comm comm) {
+    TRACE_MPI_CALL("MPI_Allgather",
+                   PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm),
+                   trace::mpi::bytes(recvcount, recvtype), -1);
+}
+
+int MPI_Reduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op,
+               int root, MPI_Comm comm) {
+    TRACE_MPI_CALL("MPI_Reduce", PMPI_Reduce(sendbuf, recvbuf, count, type, op, root, comm),
+                   trace::mpi::bytes(count, type), root);
+}
+
+int MPI_Allreduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op,
+                  MPI_Comm comm) {
+    TRACE_MPI_CALL("MPI_Allreduce", PMPI_Allreduce(sendbuf, recvbuf, count, type, op, comm),
+                   trace::mpi::bytes(count, type), -1);
+}
+
+} // extern "C"
+
+#undef TRACE_MPI_CALL
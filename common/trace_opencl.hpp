@@ -0,0 +1,45 @@
+#pragma once
+
+// OpenCL side of trace.hpp: the queue properties that switch on profiling
+// while tracing, and device(), which turns a finished command's profiling
+// timestamps into an event on the "device" track.
+
+#include <CL/cl.h>
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+
+#include "trace.hpp"
+
+namespace trace {
+
+// Queue properties that make device() work: profiling is switched on only
+// while tracing, since it can add per-command overhead on some drivers.
+inline const cl_queue_properties* queue_properties() {
+    static const cl_queue_properties kProfiling[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+    return enabled() ? kProfiling : nullptr;
+}
+
+// Records a completed command's execution on the device track and releases
+// the event. Call it after the command has finished (clFinish or a blocking
+// read); a null event is ignored.
+inline void device(cl_event ev, const char* name, const char* arg = nullptr, std::int64_t value = 0) {
+    if (!ev) return;
+    if (enabled()) {
+        cl_ulong start = 0, end = 0;
+        if (clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr) == CL_SUCCESS &&
+            clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr) == CL_SUCCESS) {
+            const std::int64_t offset = now() - static_cast<std::int64_t>(end);
+            {
+                State& s = state();
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.deviceOffset = std::min(s.deviceOffset, offset);
+            }
+            record(name, "opencl", static_cast<std::int64_t>(start), static_cast<std::int64_t>(end),
+                   arg, value, -1, true);
+        }
+    }
+    clReleaseEvent(ev);
+}
+
+} // namespace trace
@@ -0,0 +1,169 @@
+#include <mpi.h>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dispatch.hpp"
+
+// Front end for the size-aware dispatcher. Run under mpiexec so the MPI
+// backend has ranks to use; rank 0 prints everything.
+//
+//   main calibrate [path]           time all backends, write the table
+//   main table                      show the stored crossovers
+//   main sum|gradient_x|gemm N [b]  one call of size N (b forces a backend)
+//   main gemm_batched|reduce_batched COUNT [b]
+//                                   COUNT problems of kBatchEdge, batched
+//                                   and one call at a time
+//   main [bench]                    the task-2/3/4 sizes through the router
+
+static void usage() {
+    std::cerr << "usage: main calibrate [path] | table | bench\n"
+                 "       main sum|gradient_x|gemm|gemm_batched|reduce_batched N [openmp|mpi|opencl]"
+              << std::endl;
+}
+
+static void print_table(const dispatch::Table& t) {
+    for (int op = 0; op < dispatch::kOpCount; ++op) {
+        for (const auto& th : t.ops[op]) {
+            std::printf("%-14s work >= %-12.0f", dispatch::to_string(static_cast<dispatch::Op>(op)), th.work);
+            for (auto b : th.order) std::printf(" %s", dispatch::to_string(b));
+            std::printf("\n");
+        }
+    }
+    std::printf("calibrated with %d ranks\n", t.measuredRanks);
+}
+
+// One routed call of size n; the result is printed so it is not optimised
+// away and can be checked by eye (inputs are i % 10).
+static void run_one(dispatch::Dispatcher& d, dispatch::Op op, long n) {
+    const bool root = d.rank() == 0;
+    dispatch::Backend used = dispatch::Backend::OpenMP;
+    double t0 = 0.0, t1 = 0.0;
+    double check = 0.0;
+
+    if (op == dispatch::Op::Sum) {
+        std::vector<int> data(root ? n : 0);
+        for (long i = 0; i < static_cast<long>(data.size()); ++i) data[i] = static_cast<int>(i % 10);
+        t0 = MPI_Wtime();
+        check = static_cast<double>(d.sum(data.data(), n, &used));
+        t1 = MPI_Wtime();
+    } else {
+        std::vector<double> a(root ? n * n : 0), b(a.size()), c(a.size());
+        for (size_t i = 0; i < a.size(); ++i) a[i] = b[i] = static_cast<double>(i % 10);
+        t0 = MPI_Wtime();
+        if (op == dispatch::Op::GradientX) {
+            d.gradient_x(a.data(), c.data(), n, n, 0.01, &used);
+        } else {
+            d.gemm(a.data(), b.data(), c.data(), n, n, n, &used);
+        }
+        t1 = MPI_Wtime();
+        for (double v : c) check += v;
+    }
+
+    if (root) {
+        std::cout << dispatch::to_string(op) << " N=" << n
+                  << " -> " << dispatch::to_string(used)
+                  << ", Time: " << (t1 - t0) << " s"
+                  << ", checksum " << check << std::endl;
+    }
+}
+
+// `count` independent problems of edge `e` (e-element arrays or e x e
+// matrices), once as a single batched call and once as `count` routed
+// single calls, reported as problems per second.
+static void run_batched(dispatch::Dispatcher& d, dispatch::Op op, int count, int e) {
+    const bool root = d.rank() == 0;
+    const bool gemm = op == dispatch::Op::GemmBatched;
+    const long per = gemm ? long(e) * e : e;
+    dispatch::Backend batchedOn = dispatch::Backend::OpenMP, singleOn = dispatch::Backend::OpenMP;
+    double check = 0.0;
+
+    std::vector<int> ints(root && !gemm ? count * per : 0);
+    std::vector<long long> sums(root && !gemm ? count : 0);
+    std::vector<double> a(root && gemm ? count * per : 0), b(a.size()), c(a.size());
+    for (size_t i = 0; i < ints.size(); ++i) ints[i] = static_cast<int>(i % 10);
+    for (size_t i = 0; i < a.size(); ++i) a[i] = b[i] = static_cast<double>(i % 10);
+
+    double t0 = MPI_Wtime();
+    if (gemm) d.gemm_batched(a.data(), b.data(), c.data(), count, e, e, e, &batchedOn);
+    else d.reduce_batched(ints.data(), sums.data(), count, e, &batchedOn);
+    double t1 = MPI_Wtime();
+    for (double v : c) check += v;
+    for (long long v : sums) check += v;
+
+    for (int p = 0; p < count; ++p) {
+        const long off = p * per;
+        if (gemm) {
+            d.gemm(root ? a.data() + off : nullptr, root ? b.data() + off : nullptr,
+                   root ? c.data() + off : nullptr, e, e, e, &singleOn);
+        } else {
+            long long s = d.sum(root ? ints.data() + off : nullptr, e, &singleOn);
+            if (root) sums[p] = s;
+        }
+    }
+    double t2 = MPI_Wtime();
+
+    if (root) {
+        std::cout << dispatch::to_string(op) << " " << count << " x " << e
+                  << (gemm ? "x" + std::to_string(e) : "")
+                  << " -> " << dispatch::to_string(batchedOn) << ", Time: " << (t1 - t0) << " s"
+                  << ", " << count / (t1 - t0) << " problems/s"
+                  << " (one at a time on " << dispatch::to_string(singleOn) << ": "
+                  << count / (t2 - t1) << " problems/s)"
+                  << ", checksum " << check << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+    {
+        dispatch::Dispatcher d(MPI_COMM_WORLD);
+        const bool root = d.rank() == 0;
+        const std::string cmd = argc > 1 ? argv[1] : "bench";
+        dispatch::Op op;
+
+        if (cmd == "calibrate") {
+            const std::string path = argc > 2 ? argv[2] : dispatch::table_path();
+            auto table = d.calibrate(path);
+            if (root) {
+                print_table(table);
+                std::cout << "saved to " << path << std::endl;
+            }
+        } else if (cmd == "table") {
+            if (root) {
+                if (d.calibrated()) print_table(d.table());
+                else std::cout << "no table at " << dispatch::table_path() << std::endl;
+            }
+        } else if (cmd == "bench") {
+            if (root && !d.calibrated()) {
+                std::cout << "(no dispatch table, everything runs on openmp; run `make calibrate`)" << std::endl;
+            }
+            for (long n : {10L, 1000L, 10000000L}) run_one(d, dispatch::Op::Sum, n);
+            for (long n : {10L, 100L, 1000L}) run_one(d, dispatch::Op::GradientX, n);
+            for (long n : {10L, 100L, 1000L}) run_one(d, dispatch::Op::Gemm, n);
+            run_batched(d, dispatch::Op::GemmBatched, 4096, 10);
+            run_batched(d, dispatch::Op::GemmBatched, 64, 100);
+            run_batched(d, dispatch::Op::ReduceBatched, 65536, 10);
+            run_batched(d, dispatch::Op::ReduceBatched, 4096, 1000);
+        } else if (dispatch::parse_op(cmd, op) && argc > 2) {
+            dispatch::Backend forced = dispatch::Backend::OpenMP;
+            if (argc > 3) {
+                if (!dispatch::parse_backend(argv[3], forced)) {
+                    if (root) usage();
+                    MPI_Abort(MPI_COMM_WORLD, 1);
+                }
+                d.force(forced);
+            }
+            if (op == dispatch::Op::GemmBatched || op == dispatch::Op::ReduceBatched) {
+                run_batched(d, op, std::atoi(argv[2]), dispatch::kBatchEdge);
+            } else {
+                run_one(d, op, std::atol(argv[2]));
+            }
+        } else if (root) {
+            usage();
+        }
+    }
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "service.hpp"
+
+// Client for the resident server (server.cpp).
+//
+//   client load sum|stencil|matmul N [REQUESTS] [THREADS]
+//         THREADS connections send REQUESTS jobs of size N between them
+//         (N ints, an N x N grid or N x N matrices) and report client-side
+//         latency percentiles, throughput and the mean batch size
+//   client stats   the server's latency report so far
+//   client stop    shut the server down
+
+static void usage() {
+    std::cerr << "usage: client load sum|stencil|matmul N [REQUESTS] [THREADS] | stats | stop" << std::endl;
+}
+
+struct Worker {
+    service::Latencies latency;
+    double check = 0.0;
+    long batched = 0;  // sum over replies of the batch they ran in
+    long failed = 0;
+};
+
+// One connection sending `requests` jobs back to back. Inputs are i % 10,
+// so a sum's result is known and checked here.
+static void run_worker(service::Job job, int n, int requests, Worker& w) {
+    service::Client c;
+    if (!c.ok()) {
+        w.failed = requests;
+        return;
+    }
+    const size_t cells = size_t(n) * n;
+    std::vector<int> ints(job == service::Job::Sum ? n : 0);
+    std::vector<double> a(job == service::Job::Sum ? 0 : cells), out(a.size());
+    for (size_t i = 0; i < ints.size(); ++i) ints[i] = static_cast<int>(i % 10);
+    for (size_t i = 0; i < a.size(); ++i) a[i] = static_cast<double>(i % 10);
+    long long expected = 0;
+    for (int v : ints) expected += v;
+
+    for (int r = 0; r < requests; ++r) {
+        double t0 = service::now();
+        bool ok = false;
+        if (job == service::Job::Sum) {
+            long long s = 0;
+            ok = c.sum(ints.data(), n, s) && s == expected;
+            w.check += static_cast<double>(s);
+        } else if (job == service::Job::Stencil) {
+            ok = c.stencil(a.data(), out.data(), n, n, 0.01);
+        } else {
+            ok = c.matmul(a.data(), a.data(), out.data(), n, n, n);
+        }
+        w.latency.add(service::now() - t0);
+        w.batched += c.last().batch;
+        if (!ok) ++w.failed;
+    }
+    for (double v : out) w.check += v;
+}
+
+static int load(service::Job job, int n, int requests, int threads) {
+    std::vector<Worker> workers(threads);
+    std::vector<std::thread> pool;
+    double t0 = service::now();
+    for (int t = 0; t < threads; ++t) {
+        int share = requests / threads + (t < requests % threads ? 1 : 0);
+        pool.emplace_back(run_worker, job, n, share, std::ref(workers[t]));
+    }
+    for (auto& th : pool) th.join();
+    double t1 = service::now();
+
+    service::Latencies all;
+    double check = 0.0;
+    long batched = 0, failed = 0;
+    for (auto& w : workers) {
+        all.merge(w.latency);
+        check += w.check;
+        batched += w.batched;
+        failed += w.failed;
+    }
+    std::printf("%s N=%d, %d requests on %d connection(s): %s, %.0f requests/s, %.2f jobs per call, checksum %g\n",
+                service::to_string(job), n, requests, threads, all.summary().c_str(),
+                requests / (t1 - t0), all.count() ? double(batched) / all.count() : 0.0, check);
+    if (failed) std::printf("%ld request(s) failed\n", failed);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    const std::string cmd = argc > 1 ? argv[1] : "";
+    service::Job job;
+    if (cmd == "load" && argc > 3 && service::parse_job(argv[2], job) && job < service::Job::Stats) {
+        int n = std::atoi(argv[3]);
+        int requests = argc > 4 ? std::atoi(argv[4]) : 1000;
+        int threads = argc > 5 ? std::atoi(argv[5]) : 1;
+        if (n < 3 || requests < 1 || threads < 1) {
+            usage();
+            return 1;
+        }
+        return load(job, n, requests, threads);
+    }
+    if (cmd == "stats" || cmd == "stop") {
+        service::Client c;
+        std::string text;
+        if (!c.ok()) {
+            std::cerr << "no server on " << service::socket_path() << std::endl;
+            return 1;
+        }
+        if (cmd == "stats" ? !c.stats(text) : !c.shutdown()) return 1;
+        std::cout << text;
+        return 0;
+    }
+    usage();
+    return 1;
+}
@@ -0,0 +1,473 @@
+#include <mpi.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "dispatch.hpp"
+#include "service.hpp"
+
+// Resident server: one MPI world, one Dispatcher (and with it the OpenMP
+// team and the compiled OpenCL kernels) for the life of the process.
+// Rank 0 accepts jobs on a Unix socket (see service.hpp); the other ranks
+// sit in a broadcast waiting for the next dispatcher call.
+//
+// Jobs that arrive together are batched: every request already readable
+// when the loop wakes, plus whatever arrives within SERVICE_BATCH_US after
+// that, is grouped by shape and run as one call per group:
+//   sum      same n          -> reduce_batched
+//   stencil  same cols and h -> one gradient_x over the grids stacked
+//                               (rows of an x-derivative are independent)
+//   matmul   same m, n, k    -> gemm_batched
+//
+// Stop with `client stop` or SIGINT/SIGTERM; the latency report is printed
+// on the way out and returned by `client stats` at any time.
+
+namespace {
+
+// What rank 0 asks the other ranks to take part in next.
+enum Command : int {
+    kQuit = 0,
+    kSum,
+    kGradientX,
+    kGemm,
+    kGemmBatched,
+    kReduceBatched,
+};
+
+// Idle ranks back off to this between polls of the command broadcast.
+constexpr long kIdlePauseNs = 1000000;
+constexpr long kDefaultBatchUs = 100;
+constexpr std::size_t kReadChunk = 1 << 16;
+// Sum, Stencil and Matmul: the jobs with latencies worth reporting.
+constexpr int kComputeJobs = 3;
+
+volatile sig_atomic_t gStop = 0;
+
+void on_signal(int) { gStop = 1; }
+
+long batch_window_us() {
+    const char* env = std::getenv("SERVICE_BATCH_US");
+    return env ? std::atol(env) : kDefaultBatchUs;
+}
+
+// Command broadcast, then the dispatcher call every rank makes with it.
+// Only rank 0 passes data; the others learn the shape from the dispatcher.
+class Collective {
+public:
+    Collective(dispatch::Dispatcher& d, MPI_Comm comm, int size) : d_(d), comm_(comm), size_(size) {}
+
+    void announce(int cmd) {
+        if (size_ > 1) dispatch::wait_bcast(&cmd, 1, MPI_INT, comm_);
+    }
+
+    // Everything a non-root rank does until it is told to quit.
+    void follow() {
+        for (;;) {
+            int cmd = kQuit;
+            dispatch::wait_bcast(&cmd, 1, MPI_INT, comm_, kIdlePauseNs);
+            switch (cmd) {
+                case kSum: d_.sum(nullptr, 0); break;
+                case kGradientX: d_.gradient_x(nullptr, nullptr, 0, 0, 0.0); break;
+                case kGemm: d_.gemm(nullptr, nullptr, nullptr, 0, 0, 0); break;
+                case kGemmBatched: d_.gemm_batched(nullptr, nullptr, nullptr, 0, 0, 0, 0); break;
+                case kReduceBatched: d_.reduce_batched(nullptr, nullptr, 0, 0); break;
+                default: return;
+            }
+        }
+    }
+
+    long long sum(const int* data, long n, dispatch::Backend* used) {
+        announce(kSum);
+        return d_.sum(data, n, used);
+    }
+    void gradient_x(const double* in, double* out, int rows, int cols, double h, dispatch::Backend* used) {
+        announce(kGradientX);
+        d_.gradient_x(in, out, rows, cols, h, used);
+    }
+    void gemm(const double* A, const double* B, double* C, int m, int n, int k, dispatch::Backend* used) {
+        announce(kGemm);
+        d_.gemm(A, B, C, m, n, k, used);
+    }
+    void gemm_batched(const double* A, const double* B, double* C, int count, int m, int n, int k,
+                      dispatch::Backend* used) {
+        announce(kGemmBatched);
+        d_.gemm_batched(A, B, C, count, m, n, k, used);
+    }
+    void reduce_batched(const int* data, long long* out, int count, int len, dispatch::Backend* used) {
+        announce(kReduceBatched);
+        d_.reduce_batched(data, out, count, len, used);
+    }
+
+private:
+    dispatch::Dispatcher& d_;
+    MPI_Comm comm_;
+    int size_;
+};
+
+// A fully received request waiting for its batch to run.
+struct Pending {
+    int fd;
+    service::Request req;
+    std::vector<char> in;
+    std::vector<char> out;
+    double arrived = 0.0;
+    service::Reply reply;
+};
+
+struct Connection {
+    int fd;
+    std::vector<char> buf;  // bytes read but not yet a whole request
+};
+
+class Server {
+public:
+    Server(Collective& run, int ranks) : run_(run), ranks_(ranks), windowUs_(batch_window_us()) {}
+
+    bool listen(const std::string& path) {
+        sockaddr_un addr;
+        if (!service::fill_address(path, addr)) return false;
+        ::unlink(path.c_str());
+        listenFd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd_ < 0) return false;
+        if (::bind(listenFd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            ::listen(listenFd_, 128) != 0) {
+            return false;
+        }
+        ::fcntl(listenFd_, F_SETFL, O_NONBLOCK);
+        path_ = path;
+        return true;
+    }
+
+    // First touch of every kernel, so the OpenMP team, the OpenCL queues and
+    // the MPI connections are up before the first client is timed.
+    void warm_up() {
+        std::vector<int> ints(4096, 1);
+        std::vector<long long> sums(4);
+        std::vector<double> a(4 * 16 * 16, 1.0), c(a.size());
+        dispatch::Backend b;
+        run_.sum(ints.data(), static_cast<long>(ints.size()), &b);
+        run_.reduce_batched(ints.data(), sums.data(), 4, 1024, &b);
+        run_.gradient_x(a.data(), c.data(), 16, 16, 0.1, &b);
+        run_.gemm(a.data(), a.data(), c.data(), 16, 16, 16, &b);
+        run_.gemm_batched(a.data(), a.data(), c.data(), 4, 16, 16, 16, &b);
+    }
+
+    void loop() {
+        std::vector<Pending> batch;
+        while (!gStop && !quit_) {
+            wait_for_input(-1.0);
+            collect(batch);
+            if (batch.empty()) continue;
+            // Give jobs that are on their way a chance to join this batch.
+            const double deadline = service::now() + windowUs_ * 1e-6;
+            for (double left = windowUs_ * 1e-6; left > 0 && !gStop; left = deadline - service::now()) {
+                if (!wait_for_input(left)) break;
+                collect(batch);
+            }
+            execute(batch);
+            batch.clear();
+        }
+    }
+
+    void close_all() {
+        for (auto& c : conns_) ::close(c.fd);
+        conns_.clear();
+        if (listenFd_ >= 0) {
+            ::close(listenFd_);
+            ::unlink(path_.c_str());
+        }
+    }
+
+    std::string report() {
+        std::string text;
+        char line[200];
+        for (int j = 0; j < kComputeJobs; ++j) {
+            if (latency_[j].count() == 0) continue;
+            std::snprintf(line, sizeof(line), "%-8s %s\n",
+                          service::to_string(static_cast<service::Job>(j)), latency_[j].summary().c_str());
+            text += line;
+        }
+        std::snprintf(line, sizeof(line), "%ld jobs in %ld calls (%.2f jobs per call), batch window %ldus, %d ranks\n",
+                      jobs_, calls_, calls_ ? double(jobs_) / calls_ : 0.0, windowUs_, ranks_);
+        text += line;
+        return text;
+    }
+
+private:
+    // ppoll() on the listener and every connection (microsecond timeouts,
+    // unlike poll()); negative waits forever. False on timeout.
+    bool wait_for_input(double timeout) {
+        std::vector<pollfd> fds;
+        fds.push_back({listenFd_, POLLIN, 0});
+        for (const auto& c : conns_) fds.push_back({c.fd, POLLIN, 0});
+        timespec ts{static_cast<time_t>(timeout), static_cast<long>((timeout - static_cast<time_t>(timeout)) * 1e9)};
+        int ready = ::ppoll(fds.data(), fds.size(), timeout < 0 ? nullptr : &ts, nullptr);
+        if (ready <= 0) return false;
+        if (fds[0].revents & POLLIN) {
+            for (int fd; (fd = ::accept(listenFd_, nullptr, nullptr)) >= 0;) {
+                ::fcntl(fd, F_SETFL, O_NONBLOCK);
+                conns_.push_back({fd, {}});
+            }
+        }
+        return true;
+    }
+
+    // Reads whatever is available and moves every complete request into
+    // `batch`. Connections that closed or sent garbage are dropped.
+    void collect(std::vector<Pending>& batch) {
+        for (size_t i = 0; i < conns_.size();) {
+            if (drain(conns_[i], batch)) {
+                ++i;
+            } else {
+                ::close(conns_[i].fd);
+                for (auto& p : batch) {
+                    if (p.fd == conns_[i].fd) p.fd = -1;
+                }
+                conns_.erase(conns_.begin() + i);
+            }
+        }
+    }
+
+    bool drain(Connection& c, std::vector<Pending>& batch) {
+        for (;;) {
+            size_t have = c.buf.size();
+            c.buf.resize(have + kReadChunk);
+            ssize_t r = ::read(c.fd, c.buf.data() + have, kReadChunk);
+            c.buf.resize(have + (r > 0 ? r : 0));
+            if (r == 0) return false;
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return false;
+            }
+        }
+        size_t used = 0;
+        while (c.buf.size() - used >= sizeof(service::Request)) {
+            service::Request req;
+            std::memcpy(&req, c.buf.data() + used, sizeof(req));
+            std::int64_t bytes = service::request_bytes(req);
+            if (bytes < 0) {
+                service::Reply bad;
+                bad.status = static_cast<std::int32_t>(service::Status::BadRequest);
+                service::write_all(c.fd, &bad, sizeof(bad));
+                return false;
+            }
+            if (c.buf.size() - used - sizeof(req) < static_cast<size_t>(bytes)) break;
+            const char* body = c.buf.data() + used + sizeof(req);
+            Pending p;
+            p.fd = c.fd;
+            p.req = req;
+            p.in.assign(body, body + bytes);
+            p.arrived = service::now();
+            batch.push_back(std::move(p));
+            used += sizeof(req) + bytes;
+        }
+        c.buf.erase(c.buf.begin(), c.buf.begin() + used);
+        return true;
+    }
+
+    // Groups the batch by shape, runs one call per group, then answers in
+    // arrival order so pipelined replies stay in sequence.
+    void execute(std::vector<Pending>& batch) {
+        std::map<std::tuple<int, long long, long long, long long, double>, std::vector<Pending*>> groups;
+        for (auto& p : batch) {
+            const auto& r = p.req;
+            switch (static_cast<service::Job>(r.job)) {
+                case service::Job::Sum:
+                    groups[std::make_tuple(r.job, r.dims[0], 0LL, 0LL, 0.0)].push_back(&p);
+                    break;
+                case service::Job::Stencil:
+                    groups[std::make_tuple(r.job, 0LL, r.dims[1], 0LL, r.h)].push_back(&p);
+                    break;
+                case service::Job::Matmul:
+                    groups[std::make_tuple(r.job, r.dims[0], r.dims[1], r.dims[2], 0.0)].push_back(&p);
+                    break;
+                case service::Job::Shutdown:
+                    quit_ = true;
+                    break;
+                case service::Job::Stats:
+                    break;
+            }
+        }
+        for (auto& g : groups) {
+            auto& jobs = g.second;
+            for (auto* p : jobs) p->out.resize(service::reply_bytes(p->req));
+            dispatch::Backend used = dispatch::Backend::OpenMP;
+            switch (static_cast<service::Job>(std::get<0>(g.first))) {
+                case service::Job::Sum: run_sums(jobs, used); break;
+                case service::Job::Stencil: run_stencils(jobs, used); break;
+                case service::Job::Matmul: run_matmuls(jobs, used); break;
+                default: break;
+            }
+            for (auto* p : jobs) {
+                p->reply.backend = static_cast<std::int32_t>(used);
+                p->reply.batch = static_cast<std::int32_t>(jobs.size());
+            }
+            jobs_ += static_cast<long>(jobs.size());
+        }
+        for (auto& p : batch) {
+            if (p.req.job == static_cast<std::int32_t>(service::Job::Stats)) {
+                std::string text = report();
+                p.out.assign(text.begin(), text.end());
+            }
+            if (p.fd < 0) continue;
+            p.reply.bytes = static_cast<std::int64_t>(p.out.size());
+            p.reply.serverSeconds = service::now() - p.arrived;
+            bool ok = service::write_all(p.fd, &p.reply, sizeof(p.reply)) &&
+                      service::write_all(p.fd, p.out.data(), p.out.size());
+            if (p.req.job < kComputeJobs) latency_[p.req.job].add(service::now() - p.arrived);
+            if (!ok) drop(p.fd, batch);
+        }
+    }
+
+    void drop(int fd, std::vector<Pending>& batch) {
+        ::close(fd);
+        for (auto& p : batch) {
+            if (p.fd == fd) p.fd = -1;
+        }
+        for (size_t i = 0; i < conns_.size(); ++i) {
+            if (conns_[i].fd == fd) {
+                conns_.erase(conns_.begin() + i);
+                break;
+            }
+        }
+    }
+
+    void run_sums(std::vector<Pending*>& jobs, dispatch::Backend& used) {
+        const long n = static_cast<long>(jobs[0]->req.dims[0]);
+        if (jobs.size() == 1 || n > INT_MAX) {
+            for (auto* p : jobs) {
+                long long s = run_.sum(reinterpret_cast<const int*>(p->in.data()), n, &used);
+                std::memcpy(p->out.data(), &s, sizeof(s));
+                ++calls_;
+            }
+            return;
+        }
+        const int count = static_cast<int>(jobs.size());
+        std::vector<int> packed(static_cast<size_t>(count) * n);
+        std::vector<long long> sums(count);
+        for (int i = 0; i < count; ++i) std::memcpy(&packed[size_t(i) * n], jobs[i]->in.data(), n * sizeof(int));
+        run_.reduce_batched(packed.data(), sums.data(), count, static_cast<int>(n), &used);
+        for (int i = 0; i < count; ++i) std::memcpy(jobs[i]->out.data(), &sums[i], sizeof(long long));
+        ++calls_;
+    }
+
+    void run_stencils(std::vector<Pending*>& jobs, dispatch::Backend& used) {
+        const long cols = static_cast<long>(jobs[0]->req.dims[1]);
+        const double h = jobs[0]->req.h;
+        long rows = 0;
+        for (auto* p : jobs) rows += static_cast<long>(p->req.dims[0]);
+        if (jobs.size() == 1 || rows * cols > INT_MAX) {
+            for (auto* p : jobs) {
+                run_.gradient_x(reinterpret_cast<const double*>(p->in.data()),
+                                reinterpret_cast<double*>(p->out.data()),
+                                static_cast<int>(p->req.dims[0]), static_cast<int>(cols), h, &used);
+                ++calls_;
+            }
+            return;
+        }
+        std::vector<double> in(rows * cols), out(rows * cols);
+        size_t offset = 0;
+        for (auto* p : jobs) {
+            std::memcpy(&in[offset], p->in.data(), p->in.size());
+            offset += p->in.size() / sizeof(double);
+        }
+        run_.gradient_x(in.data(), out.data(), static_cast<int>(rows), static_cast<int>(cols), h, &used);
+        offset = 0;
+        for (auto* p : jobs) {
+            std::memcpy(p->out.data(), &out[offset], p->out.size());
+            offset += p->out.size() / sizeof(double);
+        }
+        ++calls_;
+    }
+
+    void run_matmuls(std::vector<Pending*>& jobs, dispatch::Backend& used) {
+        const auto* d = jobs[0]->req.dims;
+        const int m = static_cast<int>(d[0]), n = static_cast<int>(d[1]), k = static_cast<int>(d[2]);
+        const size_t a = size_t(m) * k, b = size_t(k) * n, c = size_t(m) * n;
+        if (jobs.size() == 1) {
+            const double* in = reinterpret_cast<const double*>(jobs[0]->in.data());
+            run_.gemm(in, in + a, reinterpret_cast<double*>(jobs[0]->out.data()), m, n, k, &used);
+            ++calls_;
+            return;
+        }
+        const int count = static_cast<int>(jobs.size());
+        std::vector<double> A(count * a), B(count * b), C(count * c);
+        for (int i = 0; i < count; ++i) {
+            const double* in = reinterpret_cast<const double*>(jobs[i]->in.data());
+            std::memcpy(&A[i * a], in, a * sizeof(double));
+            std::memcpy(&B[i * b], in + a, b * sizeof(double));
+        }
+        run_.gemm_batched(A.data(), B.data(), C.data(), count, m, n, k, &used);
+        for (int i = 0; i < count; ++i) std::memcpy(jobs[i]->out.data(), &C[i * c], c * sizeof(double));
+        ++calls_;
+    }
+
+    Collective& run_;
+    int ranks_;
+    long windowUs_;
+    int listenFd_ = -1;
+    std::string path_;
+    std::vector<Connection> conns_;
+    service::Latencies latency_[kComputeJobs];
+    long jobs_ = 0;
+    long calls_ = 0;
+    bool quit_ = false;
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    MPI_Init(&argc, &argv);
+    int status = 0;
+    {
+        // No SA_RESTART: poll() on rank 0 returns so the loop sees gStop.
+        struct sigaction sa;
+        std::memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_signal;
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+
+        int rank = 0, ranks = 1;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+        dispatch::Dispatcher d(MPI_COMM_WORLD);
+        Collective run(d, MPI_COMM_WORLD, ranks);
+
+        if (rank != 0) {
+            run.follow();
+        } else {
+            Server server(run, ranks);
+            const std::string path = argc > 1 ? argv[1] : service::socket_path();
+            if (server.listen(path)) {
+                server.warm_up();
+                std::cout << "listening on " << path << " with " << ranks << " rank(s):";
+                for (auto b : {dispatch::Backend::OpenMP, dispatch::Backend::MPI, dispatch::Backend::OpenCL}) {
+                    if (d.available(b)) std::cout << " " << dispatch::to_string(b);
+                }
+                std::cout << (d.calibrated() ? "" : " (no dispatch table, everything runs on openmp)") << std::endl;
+                server.loop();
+                std::cout << server.report() << std::flush;
+            } else {
+                std::cerr << "cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+                status = 1;
+            }
+            server.close_all();
+            run.announce(kQuit);
+        }
+    }
+    MPI_Finalize();
+    return status;
+}
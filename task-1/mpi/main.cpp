@@ -1,18 +1,247 @@
 #include <mpi.h>
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "comm_model.hpp"
+
+// Average MPI_Barrier latency inside `comm`, taken as the slowest rank's
+// view so skewed arrivals are not hidden.
+static double time_barrier(MPI_Comm comm, int iterations)
+{
+	for (int i = 0; i < iterations / 10; ++i) {
+		MPI_Barrier(comm);
+	}
+
+	double t0 = MPI_Wtime();
+	for (int i = 0; i < iterations; ++i) {
+		MPI_Barrier(comm);
+	}
+	double local = (MPI_Wtime() - t0) / iterations;
+
+	double slowest = 0.0;
+	MPI_Allreduce(&local, &slowest, 1, MPI_DOUBLE, MPI_MAX, comm);
+	return slowest;
+}
+
+// Iterations for a message of `bytes`: plenty for tiny messages, a handful
+// for multi-megabyte ones so the whole sweep stays in the seconds range.
+static int reps_for(size_t bytes)
+{
+	return static_cast<int>(std::max<size_t>(10, std::min<size_t>(2000, (64u << 20) / (bytes + 1024))));
+}
+
+// Half round-trip time of a ping-pong between ranks 0 and 1.
+static double ping_pong(std::vector<char>& buf, size_t bytes, int rank)
+{
+	const int reps = reps_for(bytes);
+	double t0 = 0.0;
+	for (int i = -reps / 10; i < reps; ++i) {
+		if (i == 0) t0 = MPI_Wtime();
+		if (rank == 0) {
+			MPI_Send(buf.data(), (int)bytes, MPI_BYTE, 1, 0, MPI_COMM_WORLD);
+			MPI_Recv(buf.data(), (int)bytes, MPI_BYTE, 1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		} else if (rank == 1) {
+			MPI_Recv(buf.data(), (int)bytes, MPI_BYTE, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+			MPI_Send(buf.data(), (int)bytes, MPI_BYTE, 0, 0, MPI_COMM_WORLD);
+		}
+	}
+	return (MPI_Wtime() - t0) / (2.0 * reps);
+}
+
+// Sender-side overhead o (cost of posting one small MPI_Isend) and gap g
+// (steady-state time per message in a back-to-back stream), rank 0 -> 1.
+static void overhead_and_gap(int rank, double* o, double* g)
+{
+	const int COUNT = 1000;
+	std::vector<MPI_Request> reqs(COUNT);
+	std::vector<long long> payload(COUNT);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	if (rank == 0) {
+		double posting = 0.0;
+		double t0 = MPI_Wtime();
+		for (int i = 0; i < COUNT; ++i) {
+			double p0 = MPI_Wtime();
+			MPI_Isend(&payload[i], 1, MPI_LONG_LONG, 1, 1, MPI_COMM_WORLD, &reqs[i]);
+			posting += MPI_Wtime() - p0;
+		}
+		MPI_Waitall(COUNT, reqs.data(), MPI_STATUSES_IGNORE);
+		char ack;
+		MPI_Recv(&ack, 1, MPI_CHAR, 1, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		*o = posting / COUNT;
+		*g = (MPI_Wtime() - t0) / COUNT;
+	} else if (rank == 1) {
+		for (int i = 0; i < COUNT; ++i) {
+			MPI_Recv(&payload[i], 1, MPI_LONG_LONG, 0, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		}
+		char ack = 0;
+		MPI_Send(&ack, 1, MPI_CHAR, 0, 2, MPI_COMM_WORLD);
+	}
+}
+
+// Slowest-rank time of one collective over `bytes` (total payload for
+// Scatter, per-rank payload for Bcast and Allreduce).
+enum Collective { BCAST, SCATTER, ALLREDUCE };
+
+static double time_collective(Collective kind, size_t bytes, int world_size)
+{
+	const int reps = reps_for(bytes);
+	size_t per_rank = std::max<size_t>(1, bytes / world_size);
+	std::vector<char> send(std::max(bytes, per_rank * world_size));
+	std::vector<char> recv(std::max(bytes, per_rank));
+	int doubles = (int)std::max<size_t>(1, bytes / sizeof(double));
+	std::vector<double> in(doubles), out(doubles);
+
+	MPI_Barrier(MPI_COMM_WORLD);
+	double t0 = MPI_Wtime();
+	for (int i = 0; i < reps; ++i) {
+		switch (kind) {
+		case BCAST:
+			MPI_Bcast(send.data(), (int)bytes, MPI_BYTE, 0, MPI_COMM_WORLD);
+			break;
+		case SCATTER:
+			MPI_Scatter(send.data(), (int)per_rank, MPI_BYTE, recv.data(), (int)per_rank, MPI_BYTE, 0, MPI_COMM_WORLD);
+			break;
+		case ALLREDUCE:
+			MPI_Allreduce(in.data(), out.data(), doubles, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+			break;
+		}
+	}
+	double local = (MPI_Wtime() - t0) / reps;
+	double slowest = 0.0;
+	MPI_Allreduce(&local, &slowest, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+	return slowest;
+}
+
+// Least-squares fit of t = alpha + beta * m over the ping-pong samples.
+static void fit_line(const std::vector<double>& m, const std::vector<double>& t, double* alpha, double* beta)
+{
+	double n = (double)m.size(), sm = 0, st = 0, smm = 0, smt = 0;
+	for (size_t i = 0; i < m.size(); ++i) {
+		sm += m[i];
+		st += t[i];
+		smm += m[i] * m[i];
+		smt += m[i] * t[i];
+	}
+	*beta = (n * smt - sm * st) / (n * smm - sm * sm);
+	*alpha = (st - *beta * sm) / n;
+}
+
+// Ping-pong sweep, LogGP fit and collective cross-check; rank 0 writes the
+// model to `path` for the other tasks.
+static void characterise(int world_rank, int world_size, const std::string& path)
+{
+	if (world_size < 2) {
+		if (world_rank == 0) {
+			printf("Communication model needs at least 2 ranks, skipped\n");
+		}
+		return;
+	}
+
+	std::vector<size_t> sizes;
+	for (size_t bytes = 8; bytes <= (4u << 20); bytes *= 4) {
+		sizes.push_back(bytes);
+	}
+	std::vector<char> buf(sizes.back());
+
+	std::vector<double> xs, ts;
+	for (size_t bytes : sizes) {
+		double t = ping_pong(buf, bytes, world_rank);
+		xs.push_back((double)bytes);
+		ts.push_back(t);
+		if (world_rank == 0) {
+			printf("PingPong bytes=%zu latency=%g us bandwidth=%g MB/s\n",
+			       bytes, t * 1e6, bytes / t / 1e6);
+		}
+	}
+
+	// G is the slope over the bandwidth-bound tail (>= 32 KiB); the start-up
+	// cost L + 2o comes from the smallest message, since a single fit over
+	// all sizes lets the megabyte samples swamp the intercept.
+	comm::LogGP model;
+	double alpha = 0.0, beta = 0.0;
+	auto tail = std::find_if(xs.begin(), xs.end(), [](double b) { return b >= 32768.0; });
+	size_t first = tail - xs.begin();
+	fit_line(std::vector<double>(xs.begin() + first, xs.end()),
+	         std::vector<double>(ts.begin() + first, ts.end()), &alpha, &beta);
+	model.G = std::max(beta, 0.0);
+	double startup = std::max(ts[0] - xs[0] * model.G, 0.0);
+
+	overhead_and_gap(world_rank, &model.o, &model.g);
+	model.o = std::min(model.o, startup / 2);
+	model.L = startup - 2 * model.o;
+	model.measuredRanks = world_size;
+
+	double params[4] = {model.L, model.o, model.g, model.G};
+	MPI_Bcast(params, 4, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	model.L = params[0]; model.o = params[1]; model.g = params[2]; model.G = params[3];
+
+	if (world_rank == 0) {
+		printf("LogGP L=%g us o=%g us g=%g us G=%g ns/B (%g MB/s)\n",
+		       model.L * 1e6, model.o * 1e6, model.g * 1e6, model.G * 1e9,
+		       model.G > 0 ? 1e-6 / model.G : 0.0);
+	}
+
+	const char* names[] = {"Bcast", "Scatter", "Allreduce"};
+	for (size_t bytes : sizes) {
+		for (Collective kind : {BCAST, SCATTER, ALLREDUCE}) {
+			double measured = time_collective(kind, bytes, world_size);
+			double predicted = kind == SCATTER
+				? comm::scatter_time(model, world_size, (double)bytes)
+				: kind == BCAST
+					? comm::bcast_time(model, world_size, (double)bytes)
+					: 2 * comm::bcast_time(model, world_size, (double)bytes);
+			if (world_rank == 0) {
+				printf("%s bytes=%zu measured=%g us model=%g us\n",
+				       names[kind], bytes, measured * 1e6, predicted * 1e6);
+			}
+		}
+	}
+
+	if (world_rank == 0) {
+		if (comm::save_model(model, path)) {
+			printf("Model written to %s\n", path.c_str());
+		} else {
+			printf("Could not write model to %s\n", path.c_str());
+		}
+	}
+}
 
 int main(int argc, char *argv[])
 {
-	const int ITERATIONS = 3;
+	const int ITERATIONS = 10000;
 	int world_rank, world_size;
 
 	MPI_Init(&argc, &argv);
 	MPI_Comm_size(MPI_COMM_WORLD, &world_size);
 	MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
 
-	for (int round = 0; round < ITERATIONS; ++round) {
-		printf("Process %d out of %d is alive\n", world_rank, world_size);
+	std::vector<int> rank_counts;
+	for (int n = 1; n < world_size; n *= 2) {
+		rank_counts.push_back(n);
+	}
+	rank_counts.push_back(world_size);
+
+	for (int ranks : rank_counts) {
+		MPI_Comm sub;
+		int color = world_rank < ranks ? 0 : MPI_UNDEFINED;
+		MPI_Comm_split(MPI_COMM_WORLD, color, world_rank, &sub);
+
+		if (sub != MPI_COMM_NULL) {
+			double latency = time_barrier(sub, ITERATIONS);
+			if (world_rank == 0) {
+				printf("Ranks=%d MPI_Barrier=%g us\n", ranks, latency * 1e6);
+			}
+			MPI_Comm_free(&sub);
+		}
+
+		MPI_Barrier(MPI_COMM_WORLD);
 	}
 
+	characterise(world_rank, world_size, argc > 1 ? argv[1] : comm::model_path());
+
 	MPI_Finalize();
 	return 0;
 }
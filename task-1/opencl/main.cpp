@@ -1,14 +1,44 @@
 #define CL_TARGET_OPENCL_VERSION 300
 
 #include <CL/cl.h>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <vector>
 
 static const char* kKernelSrc = R"CLC(
-__kernel void hello_opencl(__global int* out, int count) {
-    int gid = get_global_id(0);
-    out[gid] = gid;
-    barrier(CLK_GLOBAL_MEM_FENCE);
+__kernel void empty_kernel() {}
+
+// Each iteration exchanges a value through local memory, separated by a
+// work-group barrier.
+__kernel void barrier_loop(__global int* out, int iterations) {
+    __local int scratch[1024];
+    int lid = get_local_id(0);
+    int lsize = get_local_size(0);
+    int acc = 0;
+    for (int i = 0; i < iterations; ++i) {
+        scratch[lid] = acc + i;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        acc += scratch[(lid + 1) % lsize];
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    out[get_global_id(0)] = acc;
+}
+
+// Same loop and the same global store without the barriers, used to
+// subtract the arithmetic and local-memory traffic from barrier_loop. The
+// scratch is volatile so its stores and loads are not folded into `acc`;
+// the unsynchronised neighbour read only feeds the result, never the timing.
+__kernel void plain_loop(__global int* out, int iterations) {
+    volatile __local int scratch[1024];
+    int lid = get_local_id(0);
+    int lsize = get_local_size(0);
+    int acc = 0;
+    for (int i = 0; i < iterations; ++i) {
+        scratch[lid] = acc + i;
+        acc += scratch[(lid + 1) % lsize];
+    }
+    out[get_global_id(0)] = acc;
 }
 )CLC";
 
@@ -31,6 +61,29 @@ const char* clErrorString(cl_int err) {
     }
 }
 
+constexpr int kHostIterations = 1000;
+constexpr int kDeviceIterations = 10000;
+
+// Device-side execution time (ns) of one work-group of `local` items,
+// taken from the profiling event. Returns -1 when the launch fails.
+static double deviceTime(cl_command_queue queue, cl_kernel kernel, cl_mem out, size_t local) {
+    clSetKernelArg(kernel, 0, sizeof(out), &out);
+    clSetKernelArg(kernel, 1, sizeof(kDeviceIterations), &kDeviceIterations);
+
+    cl_event evt;
+    cl_int err = clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &local, &local, 0, nullptr, &evt);
+    if (err != CL_SUCCESS) {
+        return -1.0;
+    }
+    clWaitForEvents(1, &evt);
+
+    cl_ulong start = 0, end = 0;
+    clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+    clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+    clReleaseEvent(evt);
+    return static_cast<double>(end - start);
+}
+
 int main() {
     cl_int err;
     cl_uint numPlatforms = 0;
@@ -75,15 +128,19 @@ int main() {
         std::cerr << "clCreateContext failed: " << clErrorString(err) << "\n";
         return 1;
     }
-    cl_command_queue queue = clCreateCommandQueueWithProperties(context, device, nullptr, &err);
+    const cl_queue_properties queueProps[] = {CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0};
+    cl_command_queue queue = clCreateCommandQueueWithProperties(context, device, queueProps, &err);
     if (err != CL_SUCCESS) {
         std::cerr << "clCreateCommandQueue failed: " << clErrorString(err) << "\n";
         clReleaseContext(context);
         return 1;
     }
 
-    const int kNumItems = 4;
-    size_t bufSize = sizeof(int) * kNumItems;
+    size_t maxGroup = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(maxGroup), &maxGroup, nullptr);
+    maxGroup = std::min<size_t>(maxGroup, 1024);
+
+    size_t bufSize = sizeof(int) * maxGroup;
     cl_mem buf = clCreateBuffer(context, CL_MEM_WRITE_ONLY, bufSize, nullptr, &err);
     if (err != CL_SUCCESS) {
         std::cerr << "clCreateBuffer failed: " << clErrorString(err) << "\n";
@@ -108,30 +165,58 @@ int main() {
         return 1;
     }
 
-    cl_kernel kernel = clCreateKernel(program, "hello_opencl", &err);
-    if (err != CL_SUCCESS) {
-        std::cerr << "clCreateKernel failed: " << clErrorString(err) << "\n";
-        return 1;
+    cl_kernel kernels[3];
+    const char* kernelNames[3] = {"empty_kernel", "barrier_loop", "plain_loop"};
+    for (int i = 0; i < 3; ++i) {
+        kernels[i] = clCreateKernel(program, kernelNames[i], &err);
+        if (err != CL_SUCCESS) {
+            std::cerr << "clCreateKernel(" << kernelNames[i] << ") failed: " << clErrorString(err) << "\n";
+            return 1;
+        }
     }
-    clSetKernelArg(kernel, 0, sizeof(buf), &buf);
-    clSetKernelArg(kernel, 1, sizeof(kNumItems), &kNumItems);
-
-    size_t global = kNumItems;
-    size_t local  = 1;
-    err = clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &global, &local, 0, nullptr, nullptr);
-    if (err != CL_SUCCESS) {
-        std::cerr << "clEnqueueNDRangeKernel failed: " << clErrorString(err) << "\n";
+    cl_kernel emptyKernel = kernels[0];
+    cl_kernel barrierKernel = kernels[1];
+    cl_kernel plainKernel = kernels[2];
+
+    // clFinish on an idle queue: the pure host/driver round trip.
+    clFinish(queue);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < kHostIterations; ++i) {
+        clFinish(queue);
     }
-
-    std::vector<int> out(kNumItems);
-    clEnqueueReadBuffer(queue, buf, CL_TRUE, 0, bufSize, out.data(), 0, nullptr, nullptr);
-
-    for (int i = 0; i < kNumItems; ++i) {
-        std::cout << "Hello from work-item " << out[i] << "\n";
+    auto t1 = std::chrono::high_resolution_clock::now();
+    std::cout << "clFinish (idle queue): "
+              << std::chrono::duration<double, std::micro>(t1 - t0).count() / kHostIterations << " us\n";
+
+    // Launch + clFinish of an empty kernel: the fixed cost every small
+    // OpenCL kernel in this repo pays.
+    size_t one = 1;
+    t0 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < kHostIterations; ++i) {
+        clEnqueueNDRangeKernel(queue, emptyKernel, 1, nullptr, &one, &one, 0, nullptr, nullptr);
+        clFinish(queue);
+    }
+    t1 = std::chrono::high_resolution_clock::now();
+    std::cout << "Empty kernel launch + clFinish: "
+              << std::chrono::duration<double, std::micro>(t1 - t0).count() / kHostIterations << " us\n";
+
+    // Work-group barrier latency: device time of barrier_loop minus
+    // plain_loop, divided by the number of barriers each item executed.
+    for (size_t local = 1; local <= maxGroup; local *= 2) {
+        double withBarrier = deviceTime(queue, barrierKernel, buf, local);
+        double without = deviceTime(queue, plainKernel, buf, local);
+        if (withBarrier < 0 || without < 0) {
+            std::cerr << "Work-group size " << local << ": launch failed\n";
+            break;
+        }
+        double perBarrier = (withBarrier - without) / (2.0 * kDeviceIterations);
+        std::cout << "Work-group=" << local << " barrier(): " << perBarrier << " ns\n";
     }
 
     clReleaseMemObject(buf);
-    clReleaseKernel(kernel);
+    clReleaseKernel(emptyKernel);
+    clReleaseKernel(barrierKernel);
+    clReleaseKernel(plainKernel);
     clReleaseProgram(program);
     clReleaseCommandQueue(queue);
     clReleaseContext(context);
@@ -1,20 +1,113 @@
 #include <iostream>
+#include <vector>
 #include <omp.h>
 
-int main() {
-    constexpr int kThreadCount = 4;
-    omp_set_num_threads(kThreadCount);
+#include "barriers.hpp"
+
+constexpr int kIterations = 20'000;
+constexpr int kWarmup = 1'000;
 
-#pragma omp parallel default(none) shared(std::cout)
+// Written from inside otherwise empty regions so the compiler keeps them.
+static volatile int g_sink = 0;
+
+// Every thread bumps a shared counter once per episode; after the barrier
+// all of them must observe the full count, otherwise the barrier leaked.
+template <typename Barrier>
+static bool verify_barrier(int threads) {
+    Barrier barrier(threads);
+    std::atomic<int> arrived{0};
+    bool ok = true;
+#pragma omp parallel num_threads(threads) default(none) shared(barrier, arrived, threads) reduction(&&:ok)
     {
-        const int thread_id = omp_get_thread_num();
-        std::cout << "[Thread " << thread_id << "] Reporting in.\n";
+        const int tid = omp_get_thread_num();
+        for (int episode = 0; episode < 200; ++episode) {
+            arrived.fetch_add(1, std::memory_order_relaxed);
+            barrier.arrive_and_wait(tid);
+            ok = ok && arrived.load(std::memory_order_relaxed) == threads * (episode + 1);
+            barrier.arrive_and_wait(tid);
+        }
+    }
+    return ok;
+}
 
-#pragma omp barrier
+// Average latency of one barrier episode, measured on the master thread
+// between two aligned barriers.
+template <typename Barrier>
+static double time_barrier(int threads) {
+    Barrier barrier(threads);
+    double t0 = 0.0, t1 = 0.0;
+#pragma omp parallel num_threads(threads) default(none) shared(barrier, t0, t1)
+    {
+        const int tid = omp_get_thread_num();
+        for (int i = 0; i < kWarmup; ++i) {
+            barrier.arrive_and_wait(tid);
+        }
+        if (tid == 0) t0 = omp_get_wtime();
+        for (int i = 0; i < kIterations; ++i) {
+            barrier.arrive_and_wait(tid);
+        }
+        if (tid == 0) t1 = omp_get_wtime();
+    }
+    return (t1 - t0) / kIterations;
+}
 
-        if (thread_id == 0) {
-            std::cout << "[Master] All threads have arrived at the barrier.\n";
+static double time_omp_barrier(int threads) {
+    double t0 = 0.0, t1 = 0.0;
+#pragma omp parallel num_threads(threads) default(none) shared(t0, t1)
+    {
+        for (int i = 0; i < kWarmup; ++i) {
+#pragma omp barrier
         }
+#pragma omp master
+        t0 = omp_get_wtime();
+        for (int i = 0; i < kIterations; ++i) {
+#pragma omp barrier
+        }
+#pragma omp master
+        t1 = omp_get_wtime();
+    }
+    return (t1 - t0) / kIterations;
+}
+
+// Fork/join cost of an empty parallel region, the other fixed overhead every
+// small kernel pays.
+static double time_parallel_region(int threads) {
+    for (int i = 0; i < kWarmup; ++i) {
+#pragma omp parallel num_threads(threads)
+        g_sink = omp_get_thread_num();
+    }
+    double t0 = omp_get_wtime();
+    for (int i = 0; i < kIterations; ++i) {
+#pragma omp parallel num_threads(threads)
+        g_sink = omp_get_thread_num();
+    }
+    return (omp_get_wtime() - t0) / kIterations;
+}
+
+template <typename Barrier>
+static void report(int threads) {
+    const bool ok = verify_barrier<Barrier>(threads);
+    std::cout << "  " << Barrier::name() << ": ";
+    if (!ok) {
+        std::cout << "FAILED verification\n";
+        return;
+    }
+    std::cout << time_barrier<Barrier>(threads) * 1e6 << " us\n";
+}
+
+int main() {
+    const int maxThreads = std::max(4, omp_get_num_procs());
+    std::vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2) threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    for (int threads : threadCounts) {
+        std::cout << "[Threads=" << threads << "]\n";
+        std::cout << "  parallel region: " << time_parallel_region(threads) * 1e6 << " us\n";
+        std::cout << "  omp barrier: " << time_omp_barrier(threads) * 1e6 << " us\n";
+        report<barriers::SenseBarrier>(threads);
+        report<barriers::DisseminationBarrier>(threads);
+        report<barriers::TreeBarrier>(threads);
     }
 
     return 0;
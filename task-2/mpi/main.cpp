@@ -5,8 +5,16 @@
 #include <chrono>
 #include <algorithm>
 
+#include "arena.hpp"
+#include "comm_model.hpp"
+#include "compress.hpp"
+#include "numa.hpp"
+#include "perf_counters.hpp"
+#include "trace_mpi.hpp"
 
-void populate_random(std::vector<int>& data, int max_value, unsigned int seed) {
+using IntVector = arena::Vector<int>;
+
+void populate_random(IntVector& data, int max_value, unsigned int seed) {
     std::mt19937 rng(seed);
     std::uniform_int_distribution<int> dist(0, max_value - 1);
     for (auto& elem : data) {
@@ -15,6 +23,7 @@ void populate_random(std::vector<int>& data, int max_value, unsigned int seed) {
 }
 
 int sum_array(const int* arr, int length) {
+    trace::Span span("sum_array", "compute", "n", length);
     int sum = 0;
     for (int i = 0; i < length; ++i) {
         sum += arr[i];
@@ -22,63 +31,153 @@ int sum_array(const int* arr, int length) {
     return sum;
 }
 
+// Serial cost of summing one element on this rank, used to weigh compute
+// against communication when picking a plan.
+double seconds_per_element() {
+    const int kProbe = 1 << 16;
+    std::vector<int> probe(kProbe, 1);
+    volatile int sink = 0;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (int rep = 0; rep < 16; ++rep) {
+        sink = sink + sum_array(probe.data(), kProbe);
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(t1 - t0).count() / (16.0 * kProbe);
+}
+
 int main(int argc, char* argv[]) {
 
     MPI_Init(&argc, &argv);
     int world_rank = 0, world_size = 1;
     MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
     MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+    numa::report_rank_sockets(MPI_COMM_WORLD);
+
+    perf::ThreadCounters counters;
+    counters.open();
+    const perf::Peaks peaks = perf::measure_peaks(MPI_COMM_WORLD);
+    if (world_rank == 0) {
+        perf::print_peaks(peaks);
+    }
 
     const std::vector<int> kTests = {10, 1000, 10'000'000};
     const unsigned int kRandomSeed = 42;
+    const double kElementCost = world_rank == 0 ? seconds_per_element() : 0.0;
+    // The root's array of the largest size plus its own share, so every
+    // size is carved from the same huge pages.
+    arena::shared().reserve(2 * sizeof(int) * static_cast<std::size_t>(kTests.back()));
 
     for (int total_elements : kTests) {
 
-        int base_block = total_elements / world_size;
-        int extras = total_elements % world_size;
-        int local_count = base_block + (world_rank < extras ? 1 : 0);
+        comm::Plan plan;
+        bool have_model = false;
+        if (world_rank == 0) {
+            comm::Workload work;
+            work.scatterBytes = sizeof(int) * static_cast<double>(total_elements);
+            work.reduceBytes = sizeof(int);
+            work.headerMessages = 1;
+            work.computeSeconds = kElementCost * total_elements;
+            plan = comm::plan_for(work, world_size, have_model);
+        }
 
-        std::vector<int> buffer(local_count);
+        MPI_Comm active;
+        plan = comm::share_plan(plan, MPI_COMM_WORLD, &active);
+        if (active == MPI_COMM_NULL) {
+            MPI_Barrier(MPI_COMM_WORLD);
+            continue;
+        }
 
-        if (world_rank == 0) {
+        int rank = 0, size = 1;
+        MPI_Comm_rank(active, &rank);
+        MPI_Comm_size(active, &size);
 
-            std::vector<int> full_data(total_elements);
+        int base_block = total_elements / size;
+        int extras = total_elements % size;
+        int local_count = base_block + (rank < extras ? 1 : 0);
+
+        arena::reset_stats();
+        IntVector buffer(local_count);
+        IntVector full_data;
+        if (rank == 0) {
+            full_data.resize(total_elements);
             populate_random(full_data, 10, kRandomSeed);
+        }
 
-            int offset = 0;
-            for (int pid = 1; pid < world_size; ++pid) {
-                int chunk_size = base_block + (pid < extras ? 1 : 0);
-                MPI_Send(&chunk_size, 1, MPI_INT, pid, 0, MPI_COMM_WORLD);
-                MPI_Send(full_data.data() + offset, chunk_size, MPI_INT, pid, 0, MPI_COMM_WORLD);
-                offset += chunk_size;
-            }
+        double seconds = 0.0;
+        compress::reset_stats();
+        auto c0 = counters.read();
 
-            std::copy_n(full_data.data(), local_count, buffer.begin());
+        if (rank == 0) {
 
             auto t_start = std::chrono::high_resolution_clock::now();
 
-            int total_sum = sum_array(buffer.data(), local_count);
-            for (int pid = 1; pid < world_size; ++pid) {
-                int partial;
-                MPI_Recv(&partial, 1, MPI_INT, pid, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                total_sum += partial;
+            int total_sum = 0;
+            if (plan.strategy == comm::Strategy::Local) {
+                total_sum = sum_array(full_data.data(), total_elements);
+            } else if (plan.strategy == comm::Strategy::PointToPoint) {
+                int offset = local_count;
+                for (int pid = 1; pid < size; ++pid) {
+                    int chunk_size = base_block + (pid < extras ? 1 : 0);
+                    MPI_Send(&chunk_size, 1, MPI_INT, pid, 0, active);
+                    compress::send(full_data.data() + offset, chunk_size, MPI_INT, pid, 0, active);
+                    offset += chunk_size;
+                }
+
+                total_sum = sum_array(full_data.data(), local_count);
+                for (int pid = 1; pid < size; ++pid) {
+                    int partial;
+                    MPI_Recv(&partial, 1, MPI_INT, pid, 0, active, MPI_STATUS_IGNORE);
+                    total_sum += partial;
+                }
+            } else {
+                std::vector<int> counts(size), displs(size);
+                for (int pid = 0, offset = 0; pid < size; ++pid) {
+                    counts[pid] = base_block + (pid < extras ? 1 : 0);
+                    displs[pid] = offset;
+                    offset += counts[pid];
+                }
+                compress::scatterv(full_data.data(), counts.data(), displs.data(),
+                                   buffer.data(), local_count, MPI_INT, 0, active);
+                int partial = sum_array(buffer.data(), local_count);
+                MPI_Reduce(&partial, &total_sum, 1, MPI_INT, MPI_SUM, 0, active);
             }
 
             auto t_end = std::chrono::high_resolution_clock::now();
             std::chrono::duration<double> elapsed = t_end - t_start;
+            seconds = elapsed.count();
 
             std::cout << "Elements: " << total_elements
                       << ", Sum: " << total_sum
-                      << ", Duration: " << elapsed.count() << "s\n";
-        } else {
+                      << ", Duration: " << elapsed.count() << "s"
+                      << ", Plan: " << comm::to_string(plan.strategy) << " x" << size
+                      << (have_model ? "" : " (no comm model)") << std::endl;
+        } else if (plan.strategy == comm::Strategy::PointToPoint) {
 
-            MPI_Recv(&local_count, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            MPI_Recv(&local_count, 1, MPI_INT, 0, 0, active, MPI_STATUS_IGNORE);
             buffer.resize(local_count);
-            MPI_Recv(buffer.data(), local_count, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            compress::recv(buffer.data(), local_count, MPI_INT, 0, 0, active);
+
+            int partial_sum = sum_array(buffer.data(), local_count);
+            MPI_Send(&partial_sum, 1, MPI_INT, 0, 0, active);
+        } else {
 
+            compress::scatterv(nullptr, nullptr, nullptr,
+                               buffer.data(), local_count, MPI_INT, 0, active);
             int partial_sum = sum_array(buffer.data(), local_count);
-            MPI_Send(&partial_sum, 1, MPI_INT, 0, 0, MPI_COMM_WORLD);
+            MPI_Reduce(&partial_sum, nullptr, 1, MPI_INT, MPI_SUM, 0, active);
         }
+
+        auto c1 = counters.read();
+        perf::print_region(active, "sum N=" + std::to_string(total_elements), seconds,
+                           double(total_elements), sizeof(int) * double(total_elements),
+                           c1 - c0, peaks.share(size, world_size).memory_only());
+        if (rank == 0) {
+            compress::print_stats("sum N=" + std::to_string(total_elements));
+            arena::print_stats("sum N=" + std::to_string(total_elements));
+        }
+
+        MPI_Comm_free(&active);
+        MPI_Barrier(MPI_COMM_WORLD);
     }
 
     MPI_Finalize();
@@ -7,6 +7,9 @@
 #include <random>
 #include <stdexcept>
 
+#include "arena.hpp"
+#include "trace_opencl.hpp"
+
 // Помощник для проверки ошибок OpenCL
 inline void oclCheck(cl_int status, const char* stage) {
     if (status != CL_SUCCESS) {
@@ -56,7 +59,7 @@ int main() {
 
     cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &err);
     oclCheck(err, "clCreateContext");
-    cl_command_queue queue = clCreateCommandQueueWithProperties(context, device, nullptr, &err);
+    cl_command_queue queue = clCreateCommandQueueWithProperties(context, device, trace::queue_properties(), &err);
     oclCheck(err, "clCreateCommandQueueWithProperties");
 
     cl_program program = clCreateProgramWithSource(context, 1, &kKernelCode, nullptr, &err);
@@ -73,9 +76,12 @@ int main() {
     cl_kernel kernel = clCreateKernel(program, "reduce_sum", &err);
     oclCheck(err, "clCreateKernel");
 
+    arena::shared().reserve(sizeof(int) * static_cast<size_t>(testSizes.back()));
+
     for (int length : testSizes) {
 
-        std::vector<int> hostData(length);
+        arena::reset_stats();
+        arena::Vector<int> hostData(length);
         for (auto& x : hostData) x = dist(rng);
 
         cl_mem bufSrc = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
@@ -94,13 +100,22 @@ int main() {
         size_t globalSize = localSize * groupCount;
 
         auto t0 = std::chrono::high_resolution_clock::now();
-        oclCheck(clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &globalSize, &localSize,
-                                        0, nullptr, nullptr), "clEnqueueNDRangeKernel");
-        std::vector<int> partials(groupCount);
-        oclCheck(clEnqueueReadBuffer(queue, bufDst, CL_TRUE, 0,
-                                     sizeof(int) * groupCount, partials.data(), 0, nullptr, nullptr),
-                 "clEnqueueReadBuffer");
+        cl_event exec = nullptr, read = nullptr;
+        {
+            trace::Span span("clEnqueueNDRangeKernel", "opencl", "n", length);
+            oclCheck(clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &globalSize, &localSize,
+                                            0, nullptr, &exec), "clEnqueueNDRangeKernel");
+        }
+        arena::Vector<int> partials(groupCount);
+        {
+            trace::Span span("clEnqueueReadBuffer", "opencl", "bytes", sizeof(int) * groupCount);
+            oclCheck(clEnqueueReadBuffer(queue, bufDst, CL_TRUE, 0,
+                                         sizeof(int) * groupCount, partials.data(), 0, nullptr, &read),
+                     "clEnqueueReadBuffer");
+        }
         auto t1 = std::chrono::high_resolution_clock::now();
+        trace::device(exec, "reduce_sum", "n", length);
+        trace::device(read, "read partials", "bytes", sizeof(int) * groupCount);
 
         long total = 0;
         for (int v : partials) total += v;
@@ -110,6 +125,8 @@ int main() {
                   << " Sum=" << total
                   << " Time=" << elapsed.count() << "s\n";
 
+        arena::print_stats("sum N=" + std::to_string(length));
+
         clReleaseMemObject(bufSrc);
         clReleaseMemObject(bufDst);
     }
@@ -1,21 +1,78 @@
 #include <omp.h>
+#include <cstdint>
 #include <iostream>
 #include <vector>
-#include <random>
-#include <chrono>
 
+#include "barriers.hpp"
+#include "numa.hpp"
+#include "perf_counters.hpp"
+#include "trace.hpp"
 
-static std::vector<int> make_random_vector(std::size_t len, int maxVal, unsigned int seed) {
-    std::mt19937 engine(seed);
-    std::uniform_int_distribution<int> dist(0, maxVal - 1);
-    std::vector<int> vec(len);
-    for (auto& v : vec) {
-        v = dist(engine);
+// Not from the arena: its blocks reuse pages an earlier size already
+// faulted in, which would undo the first-touch placement below.
+using IntVector = std::vector<int, numa::FirstTouchAllocator<int>>;
+
+// Filled with the same static schedule as the reduction below, so each
+// thread's slice is first touched (and placed) on its own NUMA node.
+static IntVector make_random_vector(std::size_t len, int maxVal, unsigned int seed) {
+    IntVector vec(len);
+#pragma omp parallel for schedule(static) default(none) shared(vec, len, maxVal, seed)
+    for (std::size_t i = 0; i < len; ++i) {
+        vec[i] = numa::random_at(seed, i, maxVal);
+    }
+    return vec;
+}
+
+// Same contents, but written by the master thread only: every page ends up
+// on the master's node. Kept as the "before" case of the bandwidth report.
+static IntVector make_random_vector_serial(std::size_t len, int maxVal, unsigned int seed) {
+    IntVector vec(len);
+    for (std::size_t i = 0; i < len; ++i) {
+        vec[i] = numa::random_at(seed, i, maxVal);
     }
     return vec;
 }
 
+// Read bandwidth of the summation kernel, per socket. The repeats are
+// lined up with a dissemination barrier (barriers.hpp), which has no shared
+// counter for the sockets to fight over.
+static numa::SocketBandwidth socket_bandwidth(const IntVector& data) {
+    constexpr int kRepeats = 5;
+    const std::size_t n = data.size();
+    const int threads = omp_get_max_threads();
+    barriers::DisseminationBarrier barrier(threads);
+    numa::SocketBandwidth result;
+    long long sink = 0;
+#pragma omp parallel num_threads(threads) default(none) shared(data, n, result, barrier) reduction(+:sink)
+    {
+        const int socket = numa::current_socket();
+        const int tid = omp_get_thread_num();
+        double busy = 0.0;
+        std::size_t bytes = 0;
+        for (int rep = 0; rep < kRepeats; ++rep) {
+            barrier.arrive_and_wait(tid);
+            double t0 = omp_get_wtime();
+#pragma omp for schedule(static) nowait
+            for (std::size_t i = 0; i < n; ++i) {
+                sink += data[i];
+                bytes += sizeof(int);
+            }
+            busy += omp_get_wtime() - t0;
+        }
+#pragma omp critical
+        result.add(socket, static_cast<double>(bytes), busy);
+    }
+    return result;
+}
+
 int main() {
+    numa::check_binding();
+    const std::string policy = numa::apply_policy();
+
+    perf::Team counters;
+    const perf::Peaks peaks = perf::measure_peaks();
+    perf::print_peaks(peaks);
+
     constexpr unsigned int kSeed = 42;
     constexpr int kMaxValue = 10;
     const std::vector<std::size_t> kSizes = {10, 1'000, 10'000'000};
@@ -23,19 +80,42 @@ int main() {
     for (auto n : kSizes) {
         auto data = make_random_vector(n, kMaxValue, kSeed);
 
+        auto c0 = counters.sample();
         double t0 = omp_get_wtime();
 
         long long sum = 0;
-#pragma omp parallel for reduction(+:sum) default(none) shared(data, n)
-        for (std::size_t i = 0; i < n; ++i) {
-            sum += data[i];
+        {
+            trace::Span region("sum", "omp", "n", n);
+#pragma omp parallel reduction(+:sum) default(none) shared(data, n)
+            {
+                trace::Span chunk("sum chunk", "omp");
+#pragma omp for schedule(static) nowait
+                for (std::size_t i = 0; i < n; ++i) {
+                    sum += data[i];
+                }
+            }
         }
 
         double t1 = omp_get_wtime();
+        auto c1 = counters.sample();
 
         std::cout << "[N=" << n << "] Sum=" << sum
-                  << "  Time=" << (t1 - t0) << "s\n";
+                  << "  Time=" << (t1 - t0) << "s" << std::endl;
+        perf::print_region("sum N=" + std::to_string(n), t1 - t0, double(n), sizeof(int) * double(n),
+                           c1 - c0, peaks.memory_only());
     }
 
+    const std::size_t n = kSizes.back();
+    std::cout << "Per-socket read bandwidth, N=" << n << ", policy=" << policy
+              << ", " << numa::describe_binding() << "\n";
+    auto before = socket_bandwidth(make_random_vector_serial(n, kMaxValue, kSeed));
+    auto after = socket_bandwidth(make_random_vector(n, kMaxValue, kSeed));
+    before.for_each([](int socket, double gbs) {
+        std::cout << "  socket " << socket << " serial init: " << gbs << " GB/s\n";
+    });
+    after.for_each([](int socket, double gbs) {
+        std::cout << "  socket " << socket << " first touch: " << gbs << " GB/s\n";
+    });
+
     return 0;
 }
@@ -4,13 +4,24 @@
 #include <cmath>
 #include <chrono>
 
+#include "arena.hpp"
+#include "comm_model.hpp"
+#include "numa.hpp"
+#include "perf_counters.hpp"
+#include "stencil.hpp"
+#include "trace_mpi.hpp"
+
 constexpr double kDx = 0.01;
+// Accuracy order of the x-derivative stencil (2, 4, 6 or 8).
+constexpr int kOrder = 4;
+
+using Field = arena::Vector<double>;
 
 inline double evalFunc(double x, double y) {
     return x * (std::sin(x) + std::cos(y));
 }
 
-void initField(std::vector<double>& field, int rows, int cols) {
+void initField(Field& field, int rows, int cols) {
     for (int i = 0; i < rows; ++i) {
         double xi = i * kDx;
         for (int j = 0; j < cols; ++j) {
@@ -19,17 +30,26 @@ void initField(std::vector<double>& field, int rows, int cols) {
     }
 }
 
-void computeDx(const std::vector<double>& in, std::vector<double>& out,
+// Rows only need their own values: the x stencil never crosses rows.
+void computeDx(const Field& in, Field& out,
                int startRow, int rowCount, int cols)
 {
-    for (int i = startRow; i < startRow + rowCount; ++i) {
-        int rowOffset = i * cols;
-        for (int j = 0; j < cols; ++j) {
-            double left  = (j > 0)        ? in[rowOffset + j - 1] : in[rowOffset + j];
-            double right = (j < cols - 1) ? in[rowOffset + j + 1] : in[rowOffset + j];
-            out[rowOffset + j] = (right - left) / ( (j==0 || j==cols-1) ? kDx : (2 * kDx) );
-        }
+    trace::Span span("computeDx", "compute", "rows", rowCount);
+    int rows = static_cast<int>(in.size()) / cols;
+    stencil::derivative<kOrder, stencil::Axis::X>(in.data(), out.data(), rows, cols,
+                                                  kDx, kDx, startRow, startRow + rowCount);
+}
+
+// Serial cost of differentiating one grid point on this rank.
+double secondsPerPoint() {
+    const int kProbe = 128;
+    Field in(kProbe * kProbe, 1.0), out(kProbe * kProbe);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (int rep = 0; rep < 8; ++rep) {
+        computeDx(in, out, 0, kProbe, kProbe);
     }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(t1 - t0).count() / (8.0 * kProbe * kProbe);
 }
 
 int main(int argc, char** argv) {
@@ -38,62 +58,143 @@ int main(int argc, char** argv) {
     int worldRank = 0, worldSize = 1;
     MPI_Comm_rank(MPI_COMM_WORLD, &worldRank);
     MPI_Comm_size(MPI_COMM_WORLD, &worldSize);
+    numa::report_rank_sockets(MPI_COMM_WORLD);
+
+    perf::ThreadCounters counters;
+    counters.open();
+    const perf::Peaks peaks = perf::measure_peaks(MPI_COMM_WORLD);
+    if (worldRank == 0) {
+        perf::print_peaks(peaks);
+    }
 
     std::vector<int> gridSizes = {10, 100, 1000};
 
+    const double pointCost = worldRank == 0 ? secondsPerPoint() : 0.0;
+    // Both fields of the largest grid, so every size is carved from the
+    // same huge pages.
+    arena::shared().reserve(2 * sizeof(double) * gridSizes.back() * gridSizes.back());
+
     for (int N : gridSizes) {
         int rows = N, cols = N;
-        int baseRows = rows / worldSize;
-        int extra   = rows % worldSize;
-        int myRows  = baseRows + (worldRank < extra ? 1 : 0);
-        int myStart = worldRank * baseRows + std::min(worldRank, extra);
-
-        std::vector<double> fieldA(rows * cols);
-        std::vector<double> fieldB(rows * cols);
 
+        comm::Plan plan;
+        bool haveModel = false;
         if (worldRank == 0) {
+            comm::Workload work;
+            work.scatterBytes = sizeof(double) * static_cast<double>(rows) * cols;
+            work.gatherBytes = work.scatterBytes;
+            work.headerMessages = 2;
+            work.computeSeconds = pointCost * rows * cols;
+            plan = comm::plan_for(work, worldSize, haveModel);
+        }
+
+        MPI_Comm active;
+        plan = comm::share_plan(plan, MPI_COMM_WORLD, &active);
+        if (active == MPI_COMM_NULL) {
+            MPI_Barrier(MPI_COMM_WORLD);
+            continue;
+        }
+
+        int rank = 0, size = 1;
+        MPI_Comm_rank(active, &rank);
+        MPI_Comm_size(active, &size);
+
+        int baseRows = rows / size;
+        int extra   = rows % size;
+        int myRows  = baseRows + (rank < extra ? 1 : 0);
+        int myStart = rank * baseRows + std::min(rank, extra);
+
+        arena::reset_stats();
+        Field fieldA(rows * cols);
+        Field fieldB(rows * cols);
+
+        std::vector<int> counts(size), displs(size);
+        for (int pid = 0; pid < size; ++pid) {
+            counts[pid] = (baseRows + (pid < extra ? 1 : 0)) * cols;
+            displs[pid] = (pid * baseRows + std::min(pid, extra)) * cols;
+        }
+
+        if (rank == 0) {
             initField(fieldA, rows, cols);
+        }
 
+        double seconds = 0.0;
+        auto c0 = counters.read();
+
+        if (plan.strategy == comm::Strategy::Collective) {
             auto t0 = std::chrono::high_resolution_clock::now();
 
-            for (int pid = 1; pid < worldSize; ++pid) {
+            MPI_Scatterv(fieldA.data(), counts.data(), displs.data(), MPI_DOUBLE,
+                         rank == 0 ? MPI_IN_PLACE : fieldA.data() + myStart * cols,
+                         myRows * cols, MPI_DOUBLE, 0, active);
+            computeDx(fieldA, fieldB, myStart, myRows, cols);
+            MPI_Gatherv(rank == 0 ? MPI_IN_PLACE : fieldB.data() + myStart * cols,
+                        myRows * cols, MPI_DOUBLE,
+                        fieldB.data(), counts.data(), displs.data(), MPI_DOUBLE, 0, active);
+
+            auto t1 = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double> dt = t1 - t0;
+            seconds = dt.count();
+            if (rank == 0) {
+                std::cout << "Grid " << rows << "×" << cols
+                          << " -> time: " << dt.count() << " s"
+                          << " [" << comm::to_string(plan.strategy) << " x" << size << "]" << std::endl;
+            }
+        }
+        else if (rank == 0) {
+            auto t0 = std::chrono::high_resolution_clock::now();
+
+            for (int pid = 1; pid < size; ++pid) {
                 int rowsToSend = baseRows + (pid < extra ? 1 : 0);
                 int startRow   = pid * baseRows + std::min(pid, extra);
-                MPI_Send(&rowsToSend, 1, MPI_INT, pid, 0, MPI_COMM_WORLD);
-                MPI_Send(&startRow,   1, MPI_INT, pid, 0, MPI_COMM_WORLD);
+                MPI_Send(&rowsToSend, 1, MPI_INT, pid, 0, active);
+                MPI_Send(&startRow,   1, MPI_INT, pid, 0, active);
                 MPI_Send(fieldA.data() + startRow * cols,
-                         rowsToSend * cols, MPI_DOUBLE, pid, 0, MPI_COMM_WORLD);
+                         rowsToSend * cols, MPI_DOUBLE, pid, 0, active);
             }
 
-            computeDx(fieldA, fieldB, 0, baseRows + (0 < extra ? 1 : 0), cols);
+            computeDx(fieldA, fieldB, 0, myRows, cols);
 
-            for (int pid = 1; pid < worldSize; ++pid) {
+            for (int pid = 1; pid < size; ++pid) {
                 int rowsGot, startGot;
-                MPI_Recv(&rowsGot,  1, MPI_INT, pid, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                MPI_Recv(&startGot, 1, MPI_INT, pid, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                MPI_Recv(&rowsGot,  1, MPI_INT, pid, 1, active, MPI_STATUS_IGNORE);
+                MPI_Recv(&startGot, 1, MPI_INT, pid, 1, active, MPI_STATUS_IGNORE);
                 MPI_Recv(fieldB.data() + startGot * cols,
-                         rowsGot * cols, MPI_DOUBLE, pid, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                         rowsGot * cols, MPI_DOUBLE, pid, 1, active, MPI_STATUS_IGNORE);
             }
 
             auto t1 = std::chrono::high_resolution_clock::now();
             std::chrono::duration<double> dt = t1 - t0;
+            seconds = dt.count();
             std::cout << "Grid " << rows << "×" << cols
-                      << " -> time: " << dt.count() << " s\n";
+                      << " -> time: " << dt.count() << " s"
+                      << " [" << comm::to_string(plan.strategy) << " x" << size
+                      << (haveModel ? "" : ", no comm model") << "]" << std::endl;
         }
         else {
-            MPI_Recv(&myRows,  1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            MPI_Recv(&myStart, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            MPI_Recv(&myRows,  1, MPI_INT, 0, 0, active, MPI_STATUS_IGNORE);
+            MPI_Recv(&myStart, 1, MPI_INT, 0, 0, active, MPI_STATUS_IGNORE);
             MPI_Recv(fieldA.data() + myStart * cols,
-                     myRows * cols, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                     myRows * cols, MPI_DOUBLE, 0, 0, active, MPI_STATUS_IGNORE);
 
             computeDx(fieldA, fieldB, myStart, myRows, cols);
 
-            MPI_Send(&myRows,  1, MPI_INT, 0, 1, MPI_COMM_WORLD);
-            MPI_Send(&myStart, 1, MPI_INT, 0, 1, MPI_COMM_WORLD);
+            MPI_Send(&myRows,  1, MPI_INT, 0, 1, active);
+            MPI_Send(&myStart, 1, MPI_INT, 0, 1, active);
             MPI_Send(fieldB.data() + myStart * cols,
-                     myRows * cols, MPI_DOUBLE, 0, 1, MPI_COMM_WORLD);
+                     myRows * cols, MPI_DOUBLE, 0, 1, active);
+        }
+
+        auto c1 = counters.read();
+        const double points = double(rows) * cols;
+        perf::print_region(active, "computeDx " + std::to_string(N), seconds,
+                           (1.5 * kOrder + 1) * points,
+                           2 * sizeof(double) * points, c1 - c0, peaks.share(size, worldSize));
+        if (rank == 0) {
+            arena::print_stats("computeDx " + std::to_string(N));
         }
 
+        MPI_Comm_free(&active);
         MPI_Barrier(MPI_COMM_WORLD);
     }
 
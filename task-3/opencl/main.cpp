@@ -5,28 +5,15 @@
 #include <vector>
 #include <cmath>
 #include <chrono>
+#include <string>
 
-const char* clSource = R"CLC(
-__kernel void computeDerivativeX(__global const double* input,
-                                 __global double* output,
-                                 const int rows,
-                                 const int cols,
-                                 const double dx) {
-    int gid = get_global_id(0);
-    if (gid >= rows) return;
-
-    for (int j = 0; j < cols; ++j) {
-        int idx = gid * cols + j;
-
-        if (j == 0)
-            output[idx] = (input[gid * cols + j + 1] - input[idx]) / dx;
-        else if (j == cols - 1)
-            output[idx] = (input[idx] - input[gid * cols + j - 1]) / dx;
-        else
-            output[idx] = (input[gid * cols + j + 1] - input[gid * cols + j - 1]) / (2.0 * dx);
-    }
-}
-)CLC";
+#include "arena.hpp"
+#include "stencil.hpp"
+#include "trace_opencl.hpp"
+
+// Accuracy order of the x-derivative stencil (2, 4, 6 or 8); the kernel is
+// generated from the same coefficient tables the CPU versions use.
+constexpr int kOrder = 4;
 
 constexpr double dx = 0.01;
 
@@ -50,9 +37,11 @@ int main() {
     cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &err);
     if (err != CL_SUCCESS) return 1;
 
-    cl_command_queue queue = clCreateCommandQueueWithProperties(context, device, 0, &err);
+    cl_command_queue queue = clCreateCommandQueueWithProperties(context, device, trace::queue_properties(), &err);
     if (err != CL_SUCCESS) return 1;
 
+    const std::string source = stencil::opencl_source<kOrder, stencil::Axis::X>("computeDerivativeX");
+    const char* clSource = source.c_str();
     cl_program program = clCreateProgramWithSource(context, 1, &clSource, nullptr, &err);
     if (err != CL_SUCCESS) return 1;
 
@@ -70,12 +59,16 @@ int main() {
     if (err != CL_SUCCESS) return 1;
 
 
+    arena::shared().reserve(2 * sizeof(double) * dimensions.back() * dimensions.back());
+
     for (int size : dimensions) {
         int rows = size;
         int cols = size;
         size_t dataSize = rows * cols;
 
-        std::vector<double> input(dataSize), output(dataSize, 0.0);
+        // output is overwritten by the read-back, so it is left uninitialised.
+        arena::reset_stats();
+        arena::Vector<double> input(dataSize), output(dataSize);
 
         for (int i = 0; i < rows; ++i)
             for (int j = 0; j < cols; ++j)
@@ -93,23 +86,38 @@ int main() {
         clSetKernelArg(kernel, 2, sizeof(int), &rows);
         clSetKernelArg(kernel, 3, sizeof(int), &cols);
         clSetKernelArg(kernel, 4, sizeof(double), &dx);
+        clSetKernelArg(kernel, 5, sizeof(double), &dx);
 
-        size_t globalSize = rows;
+        // One work-item per grid point: (column, row).
+        size_t globalSize[2] = {static_cast<size_t>(cols), static_cast<size_t>(rows)};
 
         auto t1 = std::chrono::high_resolution_clock::now();
 
-        err = clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &globalSize, nullptr, 0, nullptr, nullptr);
+        cl_event exec = nullptr, read = nullptr;
+        {
+            trace::Span span("clEnqueueNDRangeKernel", "opencl", "points", dataSize);
+            err = clEnqueueNDRangeKernel(queue, kernel, 2, nullptr, globalSize, nullptr, 0, nullptr, &exec);
+        }
         if (err != CL_SUCCESS) return 1;
 
-        clFinish(queue);
+        {
+            trace::Span span("clFinish", "opencl");
+            clFinish(queue);
+        }
 
-        clEnqueueReadBuffer(queue, outputBuf, CL_TRUE, 0, sizeof(double) * dataSize, output.data(), 0, nullptr, nullptr);
+        {
+            trace::Span span("clEnqueueReadBuffer", "opencl", "bytes", sizeof(double) * dataSize);
+            clEnqueueReadBuffer(queue, outputBuf, CL_TRUE, 0, sizeof(double) * dataSize, output.data(), 0, nullptr, &read);
+        }
 
         auto t2 = std::chrono::high_resolution_clock::now();
+        trace::device(exec, "computeDerivativeX", "points", dataSize);
+        trace::device(read, "read output", "bytes", sizeof(double) * dataSize);
         std::chrono::duration<double> delta = t2 - t1;
 
         std::cout << "Grid size: " << rows << "x" << cols
                   << ", Time: " << delta.count() << " seconds" << std::endl;
+        arena::print_stats("grid " + std::to_string(size));
 
         clReleaseMemObject(inputBuf);
         clReleaseMemObject(outputBuf);
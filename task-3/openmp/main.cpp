@@ -1,49 +1,106 @@
 #include <omp.h>
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <vector>
 
+#include "numa.hpp"
+#include "perf_counters.hpp"
+#include "stencil.hpp"
+#include "trace.hpp"
+
+// Not from the arena: its blocks reuse pages an earlier size already
+// faulted in, so the first-touch placement below would not hold.
+using Grid = std::vector<double, numa::FirstTouchAllocator<double>>;
+
 static double evaluate(double x, double y) {
     return x * (std::sin(x) + std::cos(y));
 }
 
-void compute_dx(const std::vector<std::vector<double>>& in,
-                std::vector<std::vector<double>>& out,
-                double delta) {
-    int rows = in.size();
-    int cols = in[0].size();
-#pragma omp parallel for collapse(2) schedule(static)
+// d/dy of evaluate(), to check the accuracy of each stencil order.
+static double exact_dy(double x, double y) {
+    return -x * std::sin(y);
+}
+
+// Row-major grids. Rows are split with schedule(static) both here and in
+// the initialisation, so each thread differentiates the rows whose pages it
+// touched first.
+template <int Order>
+void compute_dx(const Grid& in, Grid& out, int rows, int cols, double delta) {
+    trace::Span region("compute_dx", "omp", "order", Order);
+#pragma omp parallel
+    {
+        trace::Span chunk("compute_dx chunk", "omp");
+#pragma omp for schedule(static) nowait
+        for (int r = 0; r < rows; ++r) {
+            stencil::derivative<Order, stencil::Axis::X>(in.data(), out.data(), rows, cols,
+                                                        delta, delta, r, r + 1);
+        }
+    }
+}
+
+// Largest error against exact_dy away from the edges, where every order
+// uses its full stencil.
+static double interior_error(const Grid& deriv, int rows, int cols, double delta) {
+    double worst = 0.0;
+#pragma omp parallel for schedule(static) reduction(max:worst)
     for (int r = 0; r < rows; ++r) {
-        for (int c = 0; c < cols; ++c) {
-            double left  = (c > 0)        ? in[r][c - 1] : in[r][c];
-            double right = (c < cols - 1) ? in[r][c + 1] : in[r][c];
-            out[r][c] = (right - left) / ((c == 0 || c == cols - 1) ? delta : (2 * delta));
+        for (int c = stencil::kMaxRadius; c < cols - stencil::kMaxRadius; ++c) {
+            double e = std::fabs(deriv[static_cast<std::size_t>(r) * cols + c] - exact_dy(r * delta, c * delta));
+            worst = std::max(worst, e);
         }
     }
+    return worst;
+}
+
+template <int Order>
+void run_order(const Grid& grid, Grid& deriv, int R, int C, double dx,
+               const perf::Team& counters, const perf::Peaks& peaks) {
+    auto c0 = counters.sample();
+    double t_start = omp_get_wtime();
+    compute_dx<Order>(grid, deriv, R, C, dx);
+    double t_end   = omp_get_wtime();
+    auto c1 = counters.sample();
+
+    std::cout << "Size " << R << "x" << C << " order " << Order
+              << " -> Time: " << (t_end - t_start) << " s"
+              << ", max interior error: " << interior_error(deriv, R, C, dx) << std::endl;
+    // Order / 2 subtract-multiply-adds plus one scale per point; read +
+    // write 8 bytes.
+    const double points = double(R) * C;
+    perf::print_region("compute_dx<" + std::to_string(Order) + "> " + std::to_string(R),
+                       t_end - t_start, (1.5 * Order + 1) * points,
+                       2 * sizeof(double) * points, c1 - c0, peaks);
 }
 
 int main() {
+    numa::check_binding();
+    numa::apply_policy();
+
+    perf::Team counters;
+    const perf::Peaks peaks = perf::measure_peaks();
+    perf::print_peaks(peaks);
+
     std::vector<int> sizes = {10, 100, 1000};
     constexpr double dx = 0.01;
 
     for (auto N : sizes) {
         int R = N, C = N;
-        std::vector<std::vector<double>> grid(R, std::vector<double>(C));
-        std::vector<std::vector<double>> deriv(R, std::vector<double>(C));
+        Grid grid(static_cast<std::size_t>(R) * C);
+        Grid deriv(static_cast<std::size_t>(R) * C);
 
-#pragma omp parallel for collapse(2) schedule(static)
+#pragma omp parallel for schedule(static)
         for (int r = 0; r < R; ++r) {
             for (int c = 0; c < C; ++c) {
-                grid[r][c] = evaluate(r * dx, c * dx);
+                grid[static_cast<std::size_t>(r) * C + c] = evaluate(r * dx, c * dx);
+                deriv[static_cast<std::size_t>(r) * C + c] = 0.0;
             }
         }
 
-        double t_start = omp_get_wtime();
-        compute_dx(grid, deriv, dx);
-        double t_end   = omp_get_wtime();
-
-        std::cout << "Size " << R << "x" << C
-                  << " -> Time: " << (t_end - t_start) << " s\n";
+        run_order<2>(grid, deriv, R, C, dx, counters, peaks);
+        run_order<4>(grid, deriv, R, C, dx, counters, peaks);
+        run_order<6>(grid, deriv, R, C, dx, counters, peaks);
+        run_order<8>(grid, deriv, R, C, dx, counters, peaks);
     }
 
     return 0;
@@ -1,91 +1,397 @@
 #include <mpi.h>
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <chrono>
+#include <cstdlib>
 #include <random>
 
+#include "arena.hpp"
+#include "comm_model.hpp"
+#include "compress.hpp"
+#include "numa.hpp"
+#include "perf_counters.hpp"
+#include "trace_mpi.hpp"
+
 constexpr int MAX_N = 2000;
 
+using Matrix = arena::Vector<double>;
+
 double computeValue(int i, int j) {
     return static_cast<double>(std::rand() % 10);
 }
 
-void multiplyChunk(const std::vector<double>& A,
-                   const std::vector<double>& B,
-                   std::vector<double>& C,
-                   int start, int count, int N) {
+void multiplyRows(const double* A, const double* B, double* C, int count, int N) {
+    trace::Span span("multiplyRows", "compute", "rows", count);
     for (int i = 0; i < count; ++i) {
-        int row = start + i;
         for (int j = 0; j < N; ++j) {
             double sum = 0.0;
             for (int k = 0; k < N; ++k) {
-                sum += A[row * N + k] * B[k * N + j];
+                sum += A[i * N + k] * B[k * N + j];
             }
-            C[row * N + j] = sum;
+            C[i * N + j] = sum;
         }
     }
 }
 
+void multiplyChunk(const Matrix& A,
+                   const Matrix& B,
+                   Matrix& C,
+                   int start, int count, int N) {
+    multiplyRows(A.data() + start * N, B.data(), C.data() + start * N, count, N);
+}
+
+// Sum of C on root. Every path prints it, so runs with MPI_SHARED=0 and
+// MPI_SHARED=1 can be compared; the entries are whole numbers, so the sum
+// is exact and must match.
+long long checksum(const double* C, int N) {
+    long long sum = 0;
+    for (long i = 0; i < static_cast<long>(N) * N; ++i) sum += static_cast<long long>(C[i]);
+    return sum;
+}
+
+// Sizes up to this are also checked against a serial multiply on root.
+constexpr int kCheckMaxN = 100;
+
+// MPI_SHARED=1: ranks on a node share a single copy of the matrices.
+bool sharedWindows() {
+    const char* env = std::getenv("MPI_SHARED");
+    return env && std::atoi(env) != 0;
+}
+
+// Makes stores to a shared window visible to the rest of the node.
+void nodeSync(MPI_Win win, MPI_Comm node) {
+    MPI_Win_sync(win);
+    MPI_Barrier(node);
+    MPI_Win_sync(win);
+}
+
+struct SharedRun {
+    double seconds = 0.0;
+    int nodes = 0;
+    int ranksOnNode = 0;
+    double nodeBytes = 0.0;
+    long long checksum = 0;  // root only
+    bool checked = false;    // root compared C with a serial multiply
+    bool matches = true;
+};
+
+// One copy of B, and of the node's rows of A and C, per node. They live in
+// an MPI_Win_allocate_shared window owned by the node leader and mapped by
+// every rank on the node. Only the leaders exchange data between nodes:
+// root scatters each node's block of A rows to the leaders, broadcasts B to
+// them and gathers their C rows back. Ranks compute their rows straight
+// out of the window. Root fills its own node's window in place, so on a
+// single node nothing is copied at all.
+SharedRun multiplyShared(MPI_Comm active, int N) {
+    int me = 0;
+    MPI_Comm_rank(active, &me);
+    MPI_Comm node, leaders;
+    MPI_Comm_split_type(active, MPI_COMM_TYPE_SHARED, me, MPI_INFO_NULL, &node);
+    int nodeRank = 0, nodeSize = 1;
+    MPI_Comm_rank(node, &nodeRank);
+    MPI_Comm_size(node, &nodeSize);
+    MPI_Comm_split(active, nodeRank == 0 ? 0 : MPI_UNDEFINED, me, &leaders);
+
+    // Nodes get rows in proportion to their rank count; root's node is
+    // leader 0 because the split keeps the active rank order.
+    SharedRun run;
+    int layout[4] = {0, 0, 0, 0};  // first row, row count, node count, is root's node
+    std::vector<int> counts, displs;
+    if (leaders != MPI_COMM_NULL) {
+        int leader = 0, nodes = 1;
+        MPI_Comm_rank(leaders, &leader);
+        MPI_Comm_size(leaders, &nodes);
+        std::vector<int> sizes(nodes);
+        MPI_Allgather(&nodeSize, 1, MPI_INT, sizes.data(), 1, MPI_INT, leaders);
+        int total = 0;
+        for (int s : sizes) total += s;
+        counts.resize(nodes);
+        displs.resize(nodes);
+        for (int j = 0, before = 0; j < nodes; ++j) {
+            int first = static_cast<int>(static_cast<long>(N) * before / total);
+            before += sizes[j];
+            int last = static_cast<int>(static_cast<long>(N) * before / total);
+            counts[j] = (last - first) * N;
+            displs[j] = first * N;
+        }
+        layout[0] = displs[leader] / N;
+        layout[1] = counts[leader] / N;
+        layout[2] = nodes;
+        layout[3] = leader == 0;
+    }
+    MPI_Bcast(layout, 4, MPI_INT, 0, node);
+    const int nodeStart = layout[0], nodeRows = layout[1];
+    const bool rootNode = layout[3] != 0;
+    // Root's node holds all of A and C so root has somewhere to put them.
+    const int rowsHere = rootNode ? N : nodeRows;
+    const int firstHere = rootNode ? 0 : nodeStart;
+
+    const MPI_Aint windowBytes = sizeof(double) * (MPI_Aint(N) * N + 2 * MPI_Aint(rowsHere) * N);
+    double* mem = nullptr;
+    MPI_Win win;
+    MPI_Win_allocate_shared(nodeRank == 0 ? windowBytes : 0, sizeof(double), MPI_INFO_NULL,
+                            node, &mem, &win);
+    if (nodeRank != 0) {
+        MPI_Aint bytes = 0;
+        int unit = 0;
+        MPI_Win_shared_query(win, 0, &bytes, &unit, &mem);
+    }
+    double* B = mem;
+    double* A = B + static_cast<size_t>(N) * N;
+    double* C = A + static_cast<size_t>(rowsHere) * N;
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+
+    if (me == 0) {
+        for (int i = 0; i < N * N; ++i) {
+            A[i] = B[i] = computeValue(i, i);
+        }
+    }
+    nodeSync(win, node);
+
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    if (leaders != MPI_COMM_NULL) {
+        compress::scatterv(A, counts.data(), displs.data(), rootNode ? MPI_IN_PLACE : A,
+                           nodeRows * N, MPI_DOUBLE, 0, leaders);
+        compress::bcast(B, N * N, MPI_DOUBLE, 0, leaders);
+    }
+    nodeSync(win, node);
+
+    int base = nodeRows / nodeSize, extra = nodeRows % nodeSize;
+    int myCount = base + (nodeRank < extra ? 1 : 0);
+    int myStart = nodeStart + nodeRank * base + std::min(nodeRank, extra);
+    multiplyRows(A + static_cast<size_t>(myStart - firstHere) * N, B,
+                 C + static_cast<size_t>(myStart - firstHere) * N, myCount, N);
+    nodeSync(win, node);
+
+    if (leaders != MPI_COMM_NULL) {
+        compress::gatherv(rootNode ? MPI_IN_PLACE : C, nodeRows * N,
+                          C, counts.data(), displs.data(), MPI_DOUBLE, 0, leaders);
+    }
+
+    auto t2 = std::chrono::high_resolution_clock::now();
+    run.seconds = std::chrono::duration<double>(t2 - t1).count();
+
+    // Root's window holds all of A (scattered in place, so unchanged) and
+    // the gathered C: a fencing or row-offset mistake shows up here.
+    if (me == 0) {
+        run.checksum = checksum(C, N);
+        if (N <= kCheckMaxN) {
+            std::vector<double> expected(static_cast<size_t>(N) * N);
+            multiplyRows(A, B, expected.data(), N, N);
+            run.checked = true;
+            run.matches = std::equal(expected.begin(), expected.end(), C);
+        }
+    }
+    run.nodes = layout[2];
+    run.ranksOnNode = nodeSize;
+    run.nodeBytes = static_cast<double>(windowBytes);
+
+    MPI_Win_unlock_all(win);
+    MPI_Win_free(&win);
+    if (leaders != MPI_COMM_NULL) MPI_Comm_free(&leaders);
+    MPI_Comm_free(&node);
+    return run;
+}
+
+// Serial cost of one multiply-add in multiplyChunk on this rank.
+double secondsPerFma() {
+    const int kProbe = 64;
+    Matrix A(kProbe * kProbe, 1.0), B(kProbe * kProbe, 1.0), C(kProbe * kProbe);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    multiplyChunk(A, B, C, 0, kProbe, kProbe);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double>(t1 - t0).count() / (double(kProbe) * kProbe * kProbe);
+}
+
 int main(int argc, char** argv) {
     MPI_Init(&argc, &argv);
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    numa::report_rank_sockets(MPI_COMM_WORLD);
+
+    perf::ThreadCounters counters;
+    counters.open();
+    const perf::Peaks peaks = perf::measure_peaks(MPI_COMM_WORLD);
+    if (rank == 0) {
+        perf::print_peaks(peaks);
+    }
 
     std::vector<int> dims = {10, 100, 1000, 2000};
     std::srand(42);
 
-    for (int N : dims) {
-        std::vector<double> A(N * N), B(N * N), C(N * N);
+    // A, B and C of the largest size, so every size (and the probe below)
+    // reuses the same pages.
+    arena::shared().reserve(3 * sizeof(double) * MAX_N * MAX_N);
+    const double fmaCost = rank == 0 ? secondsPerFma() : 0.0;
 
+    for (int N : dims) {
+        comm::Plan plan;
+        bool haveModel = false;
         if (rank == 0) {
+            comm::Workload work;
+            work.scatterBytes = sizeof(double) * double(N) * N;
+            work.bcastBytes = work.scatterBytes;
+            work.gatherBytes = work.scatterBytes;
+            work.headerMessages = 2;
+            work.computeSeconds = fmaCost * double(N) * N * N;
+            plan = comm::plan_for(work, size, haveModel);
+        }
+
+        MPI_Comm active;
+        plan = comm::share_plan(plan, MPI_COMM_WORLD, &active);
+        if (active == MPI_COMM_NULL) {
+            MPI_Barrier(MPI_COMM_WORLD);
+            continue;
+        }
+
+        int me = 0, ranks = 1;
+        MPI_Comm_rank(active, &me);
+        MPI_Comm_size(active, &ranks);
+
+        if (sharedWindows() && ranks > 1) {
+            compress::reset_stats();
+            auto c0 = counters.read();
+            SharedRun run = multiplyShared(active, N);
+            auto c1 = counters.read();
+            if (me == 0) {
+                // The windows fix the data movement, whatever the model chose.
+                std::cout << "N=" << N << " Time=" << run.seconds << "s"
+                          << " Plan=shared x" << ranks << " on " << run.nodes << " node(s)"
+                          << ", overrides " << comm::to_string(plan.strategy)
+                          << (haveModel ? "" : " (no comm model)")
+                          << " Checksum=" << run.checksum << std::endl;
+                if (run.checked && !run.matches) {
+                    std::cerr << "N=" << N << ": shared-window C differs from a serial multiply"
+                              << std::endl;
+                }
+                // Without the windows every rank holds B, root all of A and C
+                // and the other ranks their own rows of them.
+                std::cout << "    root node: " << run.nodeBytes / 1e6 << " MB shared by "
+                          << run.ranksOnNode << " ranks vs at least "
+                          << (run.ranksOnNode + 2.0) * sizeof(double) * N * N / 1e6
+                          << " MB in per-rank copies" << std::endl;
+            }
+            perf::print_region(active, "multiply N=" + std::to_string(N), run.seconds,
+                               2.0 * N * N * N, 3.0 * sizeof(double) * N * N, c1 - c0,
+                               peaks.share(ranks, size));
+            if (me == 0) {
+                compress::print_stats("multiply N=" + std::to_string(N));
+            }
+            MPI_Comm_free(&active);
+            MPI_Barrier(MPI_COMM_WORLD);
+            continue;
+        }
+
+        int base = N / ranks;
+        int rem  = N % ranks;
+
+        // Root holds all of A and C; a worker allocates only its own rows
+        // of them (the last worker also takes the remainder).
+        arena::reset_stats();
+        const int rowsHere = me == 0 ? N : (me < ranks - 1 ? base : base + rem);
+        Matrix A(rowsHere * N), B(N * N), C(rowsHere * N);
+
+        if (me == 0) {
             for (int i = 0; i < N * N; ++i) {
                 A[i] = B[i] = computeValue(i, i);
                 C[i] = 0.0;
             }
+        }
 
-            int base = N / size;
-            int rem  = N % size;
-            int offset = base;
+        double seconds = 0.0;
+        compress::reset_stats();
+        auto c0 = counters.read();
 
-            for (int p = 1; p < size; ++p) {
-                int rows = (p < size - 1) ? base : (base + rem);
-                MPI_Send(&offset, 1, MPI_INT, p, 0, MPI_COMM_WORLD);
-                MPI_Send(&rows,   1, MPI_INT, p, 0, MPI_COMM_WORLD);
-                MPI_Send(A.data() + offset * N, rows * N, MPI_DOUBLE, p, 0, MPI_COMM_WORLD);
-                MPI_Send(B.data(), N * N,       MPI_DOUBLE, p, 0, MPI_COMM_WORLD);
+        if (plan.strategy == comm::Strategy::Collective) {
+            std::vector<int> counts(ranks), displs(ranks);
+            for (int p = 0, offset = 0; p < ranks; ++p) {
+                int rows = (p < ranks - 1) ? base : (base + rem);
+                counts[p] = rows * N;
+                displs[p] = offset * N;
                 offset += rows;
             }
+            int myStart = displs[me] / N;
+            int myCount = counts[me] / N;
 
             auto t1 = std::chrono::high_resolution_clock::now();
-            multiplyChunk(A, B, C, 0, base, N);
 
-            for (int p = 1; p < size; ++p) {
+            compress::scatterv(A.data(), counts.data(), displs.data(),
+                               me == 0 ? MPI_IN_PLACE : A.data(),
+                               myCount * N, MPI_DOUBLE, 0, active);
+            compress::bcast(B.data(), N * N, MPI_DOUBLE, 0, active);
+            multiplyChunk(A, B, C, me == 0 ? myStart : 0, myCount, N);
+            compress::gatherv(me == 0 ? MPI_IN_PLACE : C.data(), myCount * N,
+                              C.data(), counts.data(), displs.data(), MPI_DOUBLE, 0, active);
+
+            auto t2 = std::chrono::high_resolution_clock::now();
+            seconds = std::chrono::duration<double>(t2 - t1).count();
+            if (me == 0) {
+                double dt = seconds;
+                std::cout << "N=" << N << " Time=" << dt << "s"
+                          << " Plan=" << comm::to_string(plan.strategy) << " x" << ranks
+                          << " Checksum=" << checksum(C.data(), N) << std::endl;
+            }
+
+        } else if (me == 0) {
+            auto t1 = std::chrono::high_resolution_clock::now();
+
+            // A single participating rank keeps the whole matrix.
+            int mine = ranks == 1 ? N : base;
+            int offset = mine;
+
+            for (int p = 1; p < ranks; ++p) {
+                int rows = (p < ranks - 1) ? base : (base + rem);
+                MPI_Send(&offset, 1, MPI_INT, p, 0, active);
+                MPI_Send(&rows,   1, MPI_INT, p, 0, active);
+                compress::send(A.data() + offset * N, rows * N, MPI_DOUBLE, p, 0, active);
+                compress::send(B.data(), N * N,       MPI_DOUBLE, p, 0, active);
+                offset += rows;
+            }
+
+            multiplyChunk(A, B, C, 0, mine, N);
+
+            for (int p = 1; p < ranks; ++p) {
                 int start, count;
-                MPI_Recv(&start, 1, MPI_INT, p, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                MPI_Recv(&count, 1, MPI_INT, p, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-                MPI_Recv(C.data() + start * N, count * N, MPI_DOUBLE, p, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                MPI_Recv(&start, 1, MPI_INT, p, 1, active, MPI_STATUS_IGNORE);
+                MPI_Recv(&count, 1, MPI_INT, p, 1, active, MPI_STATUS_IGNORE);
+                compress::recv(C.data() + start * N, count * N, MPI_DOUBLE, p, 1, active);
             }
 
             auto t2 = std::chrono::high_resolution_clock::now();
             double dt = std::chrono::duration<double>(t2 - t1).count();
-            std::cout << "N=" << N << " Time=" << dt << "s\n";
+            seconds = dt;
+            std::cout << "N=" << N << " Time=" << dt << "s"
+                      << " Plan=" << comm::to_string(plan.strategy) << " x" << ranks
+                      << (haveModel ? "" : " (no comm model)")
+                      << " Checksum=" << checksum(C.data(), N) << std::endl;
 
         } else {
             int start, count;
-            MPI_Recv(&start, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            MPI_Recv(&count, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            A.resize(N * N);
-            MPI_Recv(A.data() + start * N, count * N, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-            B.resize(N * N);
-            MPI_Recv(B.data(), N * N, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-
-            multiplyChunk(A, B, C, start, count, N);
-
-            MPI_Send(&start, 1, MPI_INT, 0, 1, MPI_COMM_WORLD);
-            MPI_Send(&count, 1, MPI_INT, 0, 1, MPI_COMM_WORLD);
-            MPI_Send(C.data() + start * N, count * N, MPI_DOUBLE, 0, 1, MPI_COMM_WORLD);
+            MPI_Recv(&start, 1, MPI_INT, 0, 0, active, MPI_STATUS_IGNORE);
+            MPI_Recv(&count, 1, MPI_INT, 0, 0, active, MPI_STATUS_IGNORE);
+            compress::recv(A.data(), count * N, MPI_DOUBLE, 0, 0, active);
+            compress::recv(B.data(), N * N, MPI_DOUBLE, 0, 0, active);
+
+            multiplyChunk(A, B, C, 0, count, N);
+
+            MPI_Send(&start, 1, MPI_INT, 0, 1, active);
+            MPI_Send(&count, 1, MPI_INT, 0, 1, active);
+            compress::send(C.data(), count * N, MPI_DOUBLE, 0, 1, active);
+        }
+
+        auto c1 = counters.read();
+        perf::print_region(active, "multiply N=" + std::to_string(N), seconds, 2.0 * N * N * N,
+                           3.0 * sizeof(double) * N * N, c1 - c0, peaks.share(ranks, size));
+        if (me == 0) {
+            compress::print_stats("multiply N=" + std::to_string(N));
+            arena::print_stats("multiply N=" + std::to_string(N));
         }
+
+        MPI_Comm_free(&active);
+        MPI_Barrier(MPI_COMM_WORLD);
     }
 
     MPI_Finalize();
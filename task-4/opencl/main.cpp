@@ -5,6 +5,10 @@
 #include <vector>
 #include <chrono>
 #include <cstdlib>
+#include <string>
+
+#include "arena.hpp"
+#include "trace_opencl.hpp"
 
 static const char* kernelCode = R"KERNEL(
 __kernel void matMul(
@@ -48,7 +52,7 @@ int main() {
 
     cl_context ctx = clCreateContext(nullptr, 1, &dev, nullptr, nullptr, &err);
     checkCL(err, "Context");
-    cl_command_queue q = clCreateCommandQueueWithProperties(ctx, dev, 0, &err);
+    cl_command_queue q = clCreateCommandQueueWithProperties(ctx, dev, trace::queue_properties(), &err);
     checkCL(err, "Queue");
     cl_program prog = clCreateProgramWithSource(ctx, 1, &kernelCode, nullptr, &err);
     checkCL(err, "Program");
@@ -62,9 +66,12 @@ int main() {
     cl_kernel kn = clCreateKernel(prog, "matMul", &err);
     checkCL(err, "Kernel");
 
+    arena::shared().reserve(3 * sizeof(float) * dims.back() * dims.back());
+
     for (int N : dims) {
         size_t sz = sizeof(float)*N*N;
-        std::vector<float> A(N*N), B(N*N), C(N*N, 0.f);
+        arena::reset_stats();
+        arena::Vector<float> A(N*N), B(N*N), C(N*N);
         for (auto& x:A) x = rand()%10;
         for (auto& x:B) x = rand()%10;
 
@@ -82,13 +89,26 @@ int main() {
 
         size_t g[2]={size_t(N),size_t(N)};
         auto t0=std::chrono::high_resolution_clock::now();
-        checkCL(clEnqueueNDRangeKernel(q,kn,2,nullptr,g,nullptr,0,nullptr,nullptr),"Enqueue");
-        clFinish(q);
-        checkCL(clEnqueueReadBuffer(q,mC,CL_TRUE,0,sz,C.data(),0,nullptr,nullptr),"Read");
+        cl_event exec=nullptr, read=nullptr;
+        {
+            trace::Span span("clEnqueueNDRangeKernel", "opencl", "n", N);
+            checkCL(clEnqueueNDRangeKernel(q,kn,2,nullptr,g,nullptr,0,nullptr,&exec),"Enqueue");
+        }
+        {
+            trace::Span span("clFinish", "opencl");
+            clFinish(q);
+        }
+        {
+            trace::Span span("clEnqueueReadBuffer", "opencl", "bytes", sz);
+            checkCL(clEnqueueReadBuffer(q,mC,CL_TRUE,0,sz,C.data(),0,nullptr,&read),"Read");
+        }
 
         auto t1=std::chrono::high_resolution_clock::now();
         double dt=std::chrono::duration<double>(t1-t0).count();
+        trace::device(exec, "matMul", "n", N);
+        trace::device(read, "read C", "bytes", sz);
         std::cout<<"N="<<N<<" -> "<<dt<<"s\n";
+        arena::print_stats("N=" + std::to_string(N));
 
         clReleaseMemObject(mA);
         clReleaseMemObject(mB);
@@ -1,44 +1,83 @@
 #include <omp.h>
+#include <cstdint>
 #include <iostream>
 #include <vector>
 #include <random>
 
-static std::vector<std::vector<int>> make_matrix(int R, int C) {
-    std::mt19937 eng{std::random_device{}()};
-    std::uniform_int_distribution<int> dist(1, 9);
-    std::vector<std::vector<int>> m(R, std::vector<int>(C));
-    for (int i = 0; i < R; ++i)
-        for (int j = 0; j < C; ++j)
-            m[i][j] = dist(eng);
+#include "numa.hpp"
+#include "perf_counters.hpp"
+#include "trace.hpp"
+
+// Plain vectors, not the arena: each row is allocated by the thread that
+// fills it, from that thread's own malloc arena, so the fill takes no
+// shared lock and a row's pages stay on its thread's node from one size
+// to the next.
+using Row = std::vector<int>;
+using Matrix = std::vector<Row>;
+
+// Rows are allocated and filled inside the parallel loop with the same
+// static row split matmul uses, so each row's pages are first touched by
+// the thread that later reads A[i] / writes C[i]. Values come from
+// numa::random_at so the fill order does not matter.
+static Matrix make_matrix(int R, int C) {
+    const std::uint64_t seed = std::random_device{}();
+    Matrix m(R);
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < R; ++i) {
+        Row row(C);
+        for (int j = 0; j < C; ++j) {
+            row[j] = 1 + numa::random_at(seed, std::uint64_t(i) * C + j, 9);
+        }
+        m[i] = std::move(row);
+    }
     return m;
 }
 
-static std::vector<std::vector<int>> matmul(const std::vector<std::vector<int>>& A,
-                                            const std::vector<std::vector<int>>& B) {
+static Matrix matmul(const Matrix& A, const Matrix& B) {
     int RA = A.size(), CA = A[0].size();
     int CB = B[0].size();
-    std::vector<std::vector<int>> C(RA, std::vector<int>(CB, 0));
-#pragma omp parallel for collapse(2) schedule(static)
+    Matrix C(RA);
+#pragma omp parallel for schedule(static)
     for (int i = 0; i < RA; ++i) {
-        for (int j = 0; j < CB; ++j) {
-            int sum = 0;
-            for (int k = 0; k < CA; ++k) sum += A[i][k] * B[k][j];
-            C[i][j] = sum;
+        C[i].assign(CB, 0);
+    }
+    trace::Span region("matmul", "omp", "rows", RA);
+#pragma omp parallel
+    {
+        trace::Span chunk("matmul chunk", "omp");
+#pragma omp for schedule(static) nowait
+        for (int i = 0; i < RA; ++i) {
+            for (int j = 0; j < CB; ++j) {
+                int sum = 0;
+                for (int k = 0; k < CA; ++k) sum += A[i][k] * B[k][j];
+                C[i][j] = sum;
+            }
         }
     }
     return C;
 }
 
 int main() {
+    numa::check_binding();
+    numa::apply_policy();
+
+    perf::Team counters;
+    const perf::Peaks peaks = perf::measure_peaks();
+    perf::print_peaks(peaks);
+
     std::vector<std::pair<int,int>> dims{{10,10},{100,100},{1000,1000},{2000,2000}};
     for (auto [R, C] : dims) {
         auto M1 = make_matrix(R, C);
         auto M2 = make_matrix(C, R);
+        auto c0 = counters.sample();
         double t0 = omp_get_wtime();
         auto M3 = matmul(M1, M2);
         double t1 = omp_get_wtime();
+        auto c1 = counters.sample();
         std::cout << "Multiply " << R << "x" << C << " by " << C << "x" << R
-                  << " took " << (t1 - t0) << " s\n";
+                  << " took " << (t1 - t0) << " s" << std::endl;
+        perf::print_region("matmul " + std::to_string(R), t1 - t0, 2.0 * R * C * R,
+                           sizeof(int) * (2.0 * R * C + double(R) * R), c1 - c0, peaks.memory_only());
     }
     return 0;
 }